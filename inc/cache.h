@@ -0,0 +1,33 @@
+/*
+ *  Copyright (C) 2019-2024 Scoopta
+ *  This file is part of Wofi
+ *  Wofi is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Wofi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Wofi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <wayland-util.h>
+
+struct wl_list* cache_read(const char* path);
+
+void cache_increment(const char* path, const char* cmd);
+
+void cache_remove(const char* path, const char* cmd);
+
+void cache_commit_detached(const char* path);
+
+void cache_commit_all(void);
+
+#endif
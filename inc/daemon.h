@@ -0,0 +1,37 @@
+/*
+ *  Copyright (C) 2019-2024 Scoopta
+ *  This file is part of Wofi
+ *  Wofi is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Wofi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Wofi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+
+void wofi_daemon_listen(const char* mode);
+
+int wofi_daemon_connect(const char* mode);
+
+void wofi_daemon_client(int fd);
+
+bool wofi_daemon_has_client(void);
+
+bool wofi_daemon_is_running(void);
+
+void wofi_daemon_reply_exec(const char* mode, const char* cmd, bool shift, bool ctrl, int code);
+
+void wofi_daemon_reply_exit(int status);
+
+#endif
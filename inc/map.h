@@ -25,6 +25,8 @@ struct map* map_init(void);
 
 struct map* map_init_void(void);
 
+struct map* map_init_borrowed(void);
+
 void map_free(struct map* map);
 
 bool map_put(struct map* map, const char* key, char* value);
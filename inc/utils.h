@@ -19,6 +19,7 @@
 #define UTIL_H
 
 #include <time.h>
+#include <stdbool.h>
 
 #include <sys/types.h>
 
@@ -36,4 +37,24 @@ size_t utils_distance(const char* haystack, const char* needle);
 
 void utils_mkdir(char *path, mode_t mode);
 
+const char* utils_intern(const char* str);
+
+struct utils_arena* utils_arena_new(void);
+
+void* utils_arena_alloc(struct utils_arena* arena, size_t size);
+
+char* utils_arena_strdup(struct utils_arena* arena, const char* str);
+
+void utils_arena_free(struct utils_arena* arena);
+
+#define UTILS_SCAN_FILES 1
+#define UTILS_SCAN_DIRS 2
+#define UTILS_SCAN_EXECUTABLE 4
+
+typedef void (*utils_scan_func)(int dir_fd, const char* name, bool is_dir, void* data);
+
+int utils_open_dir(int at_fd, const char* path);
+
+void utils_scan_dir(int dir_fd, int flags, utils_scan_func func, void* data);
+
 #endif
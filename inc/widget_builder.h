@@ -23,10 +23,16 @@
 #include <property_box.h>
 
 struct widget_builder {
-	WofiPropertyBox* box;
 	struct widget* widget;
 	struct mode* mode;
 	size_t actions;
+	char* search_text, *action;
+	struct wl_list parts;
+	bool detached;
 };
 
+WofiPropertyBox* wofi_widget_builder_realize(struct widget_builder* builder);
+
+struct widget_builder* wofi_widget_builder_detach(struct widget_builder* builder);
+
 #endif
@@ -22,6 +22,7 @@
 
 #include <wofi_api.h>
 
+#include <gio/gio.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
 struct css_class {
@@ -43,6 +44,10 @@ __attribute__((sentinel)) void wofi_widget_builder_insert_image(struct widget_bu
 
 void wofi_widget_builder_insert_image_with_list(struct widget_builder* builder, GdkPixbuf* pixbuf, struct wl_list* classes);
 
+__attribute__((sentinel)) void wofi_widget_builder_insert_icon(struct widget_builder* builder, GIcon* icon, ...);
+
+void wofi_widget_builder_insert_icon_with_list(struct widget_builder* builder, GIcon* icon, struct wl_list* classes);
+
 struct widget_builder* wofi_widget_builder_get_idx(struct widget_builder* builder, size_t idx);
 
 struct widget* wofi_widget_builder_get_widget(struct widget_builder* builder);
@@ -30,19 +30,41 @@ struct widget {
 	size_t action_count;
 	char* mode, **text, *search_text, **actions;
 	struct widget_builder* builder;
+	struct mode* owner;
 };
 
+//arena holds the data of every entry the mode has created, it's freed once arena_users drops to 0
 struct mode {
 	void (*mode_exec)(const gchar* cmd);
 	struct widget* (*mode_get_widget)(void);
 	char* name, *dso;
+	struct utils_arena* arena;
+	size_t arena_users;
 	struct wl_list link;
 };
 
+void wofi_start_modes(struct map* config);
+
+void wofi_start_client(struct map* config);
+
 void wofi_init(struct map* config);
 
+void wofi_show(void);
+
+void wofi_hide(void);
+
+void wofi_exec(const char* mode, const char* cmd, bool shift, bool ctrl, int code);
+
 void wofi_load_css(bool nyan);
 
+void wofi_arena_hold(struct mode* mode);
+
+void* wofi_arena_alloc(struct mode* mode, size_t size);
+
+char* wofi_arena_strdup(struct mode* mode, const char* str);
+
+void wofi_arena_release(struct mode* mode);
+
 extern unsigned char input_under_scroll;
 extern unsigned char render_only_image;
 
@@ -40,8 +40,14 @@ struct wl_list* wofi_read_cache(struct mode* mode);
 
 struct widget* wofi_create_widget(struct mode* mode, char* text[], char* search_text, char* actions[], size_t action_count);
 
+struct widget* wofi_create_widget_borrowed(struct mode* mode, char* text[], char* search_text, char* actions[], size_t action_count);
+
 void wofi_insert_widgets(struct mode* mode);
 
+void wofi_remove_widget(struct mode* mode, const char* action);
+
+void wofi_set_loading(struct mode* mode, bool loading);
+
 char* wofi_get_dso_path(struct mode* mode);
 
 bool wofi_allow_images(void);
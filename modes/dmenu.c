@@ -16,20 +16,29 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <utils.h>
 #include <config.h>
 #include <wofi_api.h>
 
 #include <pango/pango.h>
+#include <gio/gunixinputstream.h>
+
+#define BLOCK_SIZE (1 << 20)
 
-static const char* arg_names[] = {"parse_action", "separator", "print_line_num"};
+static const char* arg_names[] = {"parse_action", "separator", "print_line_num", "stream"};
 
 static bool parse_action;
 static char* separator;
 static bool print_line_num;
+static bool stream;
 static struct mode* mode;
 
 struct node {
@@ -38,12 +47,216 @@ struct node {
 };
 
 static struct wl_list widgets;
+//Backs every node in widgets, dropped once get_widget finds the list empty
+static struct utils_arena* node_arena;
 
-void wofi_dmenu_init(struct mode* this, struct map* config) {
+//Every line points into the block it was read into, blocks are never freed since the widgets borrow the lines
+static char** lines;
+static size_t line_count, line_capacity;
+static uint16_t line_num;
+
+struct reader {
+	char* block;
+	size_t capacity, size, line_start;
+	GInputStream* stream;
+};
+
+static struct node* new_node(void) {
+	if(node_arena == NULL) {
+		node_arena = utils_arena_new();
+	}
+	return utils_arena_alloc(node_arena, sizeof(struct node));
+}
+
+static void free_nodes(void) {
+	if(node_arena != NULL) {
+		utils_arena_free(node_arena);
+		node_arena = NULL;
+	}
+}
+
+static void add_line(char* line) {
+	if(line_count == line_capacity) {
+		line_capacity = line_capacity == 0 ? 1024 : line_capacity * 2;
+		lines = realloc(lines, line_capacity * sizeof(char*));
+	}
+	lines[line_count++] = line;
+}
+
+//Terminates every complete line in place and returns how many bytes were used up
+static size_t split_lines(char* data, size_t size) {
+	char* end = data + size;
+	char* ptr = data;
+	char* delim;
+	while((delim = memchr(ptr, separator[0], end - ptr)) != NULL) {
+		*delim = 0;
+		add_line(ptr);
+		ptr = delim + 1;
+	}
+	return ptr - data;
+}
+
+static bool map_stdin(void) {
+	struct stat info;
+	off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+	if(fstat(STDIN_FILENO, &info) == -1 || !S_ISREG(info.st_mode) || offset == -1 || offset >= info.st_size) {
+		return false;
+	}
+
+	//The mapping is private so the separators can be overwritten without touching the file
+	char* data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, STDIN_FILENO, 0);
+	if(data == MAP_FAILED) {
+		return false;
+	}
+	size_t size = info.st_size - offset;
+	size_t used = split_lines(data + offset, size);
+	if(used < size) {
+		//There's no room after the last byte of the file for a terminator
+		add_line(strndup(data + offset + used, size - used));
+	}
+	return true;
+}
+
+static void init_reader(struct reader* reader) {
+	reader->capacity = BLOCK_SIZE;
+	reader->size = 0;
+	reader->line_start = 0;
+	reader->block = malloc(reader->capacity);
+}
+
+//Adds any lines completed by the len bytes just read into the block
+static void add_read(struct reader* reader, size_t len) {
+	//Only the new data needs searching, the pending line before it has no separator
+	size_t scanned = reader->size;
+	reader->size += len;
+	char* delim;
+	while((delim = memchr(reader->block + scanned, separator[0], reader->size - scanned)) != NULL) {
+		*delim = 0;
+		add_line(reader->block + reader->line_start);
+		reader->line_start = scanned = delim - reader->block + 1;
+	}
+
+	if(reader->size == reader->capacity) {
+		//The line that didn't fit moves to the start of a new block
+		size_t pending = reader->size - reader->line_start;
+		size_t new_capacity = pending * 2 > BLOCK_SIZE ? pending * 2 : BLOCK_SIZE;
+		if(reader->line_start == 0) {
+			reader->block = realloc(reader->block, new_capacity);
+		} else {
+			char* next = malloc(new_capacity);
+			memcpy(next, reader->block + reader->line_start, pending);
+			reader->block = next;
+		}
+		reader->capacity = new_capacity;
+		reader->size = pending;
+		reader->line_start = 0;
+	}
+}
+
+//Does a single read and adds any lines it completed
+static ssize_t read_block(struct reader* reader) {
+	ssize_t len = read(STDIN_FILENO, reader->block + reader->size, reader->capacity - reader->size);
+	if(len > 0) {
+		add_read(reader, len);
+	}
+	return len;
+}
+
+static void finish_reader(struct reader* reader) {
+	if(reader->line_start < reader->size) {
+		reader->block[reader->size] = 0;
+		add_line(reader->block + reader->line_start);
+	} else if(reader->line_start == 0) {
+		free(reader->block);
+	}
+}
+
+static void read_stdin(void) {
+	if(map_stdin()) {
+		return;
+	}
+
+	struct reader reader;
+	init_reader(&reader);
+	ssize_t len;
+	while((len = read_block(&reader)) != 0) {
+		if(len == -1 && errno != EINTR) {
+			break;
+		}
+	}
+	finish_reader(&reader);
+}
+
+static void add_widgets(struct map* cached) {
+	for(size_t count = 0; count < line_count; ++count) {
+		char* line = lines[count];
+		if(cached != NULL && map_contains(cached, line)) {
+			continue;
+		}
+
+		struct node* widget = new_node();
+		if(print_line_num) {
+			char action[6];
+			snprintf(action, sizeof(action), "%u", line_num++);
+			char* action_ptr = action;
+			widget->widget = wofi_create_widget(mode, &line, line, &action_ptr, 1);
+		} else {
+			widget->widget = wofi_create_widget_borrowed(mode, &line, line, &line, 1);
+		}
+		wl_list_insert(&widgets, &widget->link);
+	}
+	line_count = 0;
+}
+
+//One read per call so a fast producer can't keep the main loop from drawing
+static gboolean read_stream(GObject* stream, gpointer data) {
+	struct reader* reader = data;
+	GError* err = NULL;
+	gssize len = g_pollable_input_stream_read_nonblocking(G_POLLABLE_INPUT_STREAM(stream),
+			reader->block + reader->size, reader->capacity - reader->size, NULL, &err);
+	if(err != NULL) {
+		bool would_block = g_error_matches(err, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+		g_error_free(err);
+		if(would_block) {
+			return G_SOURCE_CONTINUE;
+		}
+	}
+
+	if(len > 0) {
+		add_read(reader, len);
+	} else {
+		finish_reader(reader);
+		g_object_unref(reader->stream);
+		free(reader);
+	}
+	if(line_count > 0) {
+		add_widgets(NULL);
+		wofi_insert_widgets(mode);
+	}
+	if(len <= 0) {
+		free(lines);
+		lines = NULL;
+		line_capacity = 0;
+		wofi_set_loading(mode, false);
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static void read_args(struct mode* this, struct map* config) {
 	mode = this;
 	parse_action = strcmp(config_get(config, "parse_action", "false"), "true") == 0;
 	separator = config_get(config, "separator", "\n");
 	print_line_num = strcmp(config_get(config, "print_line_num", "false"), "true") == 0;
+	stream = strcmp(config_get(config, "stream", "false"), "true") == 0;
+}
+
+void wofi_dmenu_exec_init(struct mode* this, struct map* config) {
+	read_args(this, config);
+}
+
+void wofi_dmenu_init(struct mode* this, struct map* config) {
+	read_args(this, config);
 
 	if(strcmp(separator, "\\n") == 0) {
 		separator = "\n";
@@ -55,27 +268,40 @@ void wofi_dmenu_init(struct mode* this, struct map* config) {
 
 	wl_list_init(&widgets);
 
-	struct map* cached = map_init();
+	bool mapped = false;
+	if(stream && !isatty(STDIN_FILENO)) {
+		//A file on stdin is already complete, mapping it is quicker than streaming it in
+		mapped = map_stdin();
 
-	struct wl_list entries;
-	wl_list_init(&entries);
+		//stdin is shared with whoever started wofi so it's never made non-blocking, the stream polls it before every read instead
+		GInputStream* input = mapped ? NULL : g_unix_input_stream_new(STDIN_FILENO, FALSE);
+		if(input != NULL && g_pollable_input_stream_can_poll(G_POLLABLE_INPUT_STREAM(input))) {
+			struct reader* reader = malloc(sizeof(struct reader));
+			init_reader(reader);
+			reader->stream = input;
+			wofi_set_loading(mode, true);
+			GSource* source = g_pollable_input_stream_create_source(G_POLLABLE_INPUT_STREAM(input), NULL);
+			g_source_set_callback(source, G_SOURCE_FUNC(read_stream), reader, NULL);
+			g_source_attach(source, NULL);
+			g_source_unref(source);
+			return;
+		} else if(input != NULL) {
+			g_object_unref(input);
+		}
+	}
 
-	struct map* entry_map = map_init();
+	struct map* cached = map_init();
+
+	//The lines outlive the set so there's no need to copy them
+	struct map* entry_set = map_init_borrowed();
 
 	if(!isatty(STDIN_FILENO)) {
-		char* line = NULL;
-		size_t size = 0;
-		while(getdelim(&line, &size, separator[0], stdin) != -1) {
-			char* delim = strchr(line, separator[0]);
-			if(delim != NULL) {
-				*delim = 0;
-			}
-			struct cache_line* node = malloc(sizeof(struct cache_line));
-			node->line = strdup(line);
-			wl_list_insert(&entries, &node->link);
-			map_put(entry_map, line, "true");
+		if(!mapped) {
+			read_stdin();
+		}
+		for(size_t count = 0; count < line_count; ++count) {
+			map_put_void(entry_set, lines[count], lines[count]);
 		}
-		free(line);
 	}
 
 	if(!print_line_num) {
@@ -83,9 +309,9 @@ void wofi_dmenu_init(struct mode* this, struct map* config) {
 
 		struct cache_line* node, *tmp;
 		wl_list_for_each_safe(node, tmp, cache, link) {
-			if(map_contains(entry_map, node->line)) {
+			if(map_contains(entry_set, node->line)) {
 				map_put(cached, node->line, "true");
-				struct node* widget = malloc(sizeof(struct node));
+				struct node* widget = new_node();
 				widget->widget = wofi_create_widget(mode, &node->line, node->line, &node->line, 1);
 				wl_list_insert(&widgets, &widget->link);
 			} else {
@@ -98,31 +324,12 @@ void wofi_dmenu_init(struct mode* this, struct map* config) {
 		free(cache);
 	}
 
-	map_free(entry_map);
-
-	uint16_t line_num = 0;
-
-	struct cache_line* node, *tmp;
-	wl_list_for_each_reverse_safe(node, tmp, &entries, link) {
-		if(!map_contains(cached, node->line)) {
-
-			char* action;
-			if(print_line_num) {
-				action = malloc(6);
-				snprintf(action, 6, "%u", line_num++);
-			} else {
-				action = strdup(node->line);
-			}
+	map_free(entry_set);
 
-			struct node* widget = malloc(sizeof(struct node));
-			widget->widget = wofi_create_widget(mode, &node->line, node->line, &action, 1);
-			wl_list_insert(&widgets, &widget->link);
-			free(action);
-		}
-		free(node->line);
-		wl_list_remove(&node->link);
-		free(node);
-	}
+	add_widgets(cached);
+	free(lines);
+	lines = NULL;
+	line_capacity = 0;
 	map_free(cached);
 }
 
@@ -131,9 +338,9 @@ struct widget* wofi_dmenu_get_widget(void) {
 	wl_list_for_each_reverse_safe(node, tmp, &widgets, link) {
 		struct widget* widget = node->widget;
 		wl_list_remove(&node->link);
-		free(node);
 		return widget;
 	}
+	free_nodes();
 	return NULL;
 }
 
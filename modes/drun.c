@@ -16,38 +16,162 @@
  */
 
 #include <stdio.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include <map.h>
 #include <utils.h>
 #include <config.h>
-#include <utils_g.h>
 #include <widget_builder_api.h>
 
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 #include <gio/gdesktopappinfo.h>
 
+#define INDEX_MAGIC "WOFIDRUN"
+#define INDEX_VERSION 2
+#define INDEX_NONE UINT32_MAX
+#define WATCH_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
 static const char* arg_names[] = {"print_command", "display_generic", "disable_prime", "print_desktop_file"};
 
 static struct mode* mode;
 
+//Everything needed to build an entry, either parsed from its desktop file or borrowed from the index
+struct desktop_record {
+	char* path, *name, *generic_name, *icon, *search_text;
+	size_t action_count;
+	char** actions, **action_names;
+	bool parsed, shown, owned;
+	struct wl_list link;
+};
+
+struct scanned_dir {
+	char* path;
+	uint32_t parent;
+	uint64_t dev, ino;
+	int64_t mtime_sec, mtime_nsec;
+	struct wl_list records;
+	struct wl_list link;
+};
+
 struct desktop_entry {
 	char* full_path;
+	struct desktop_record* record;
+	bool owns_record;
+	struct wl_list link;
+};
+
+struct node {
+	struct widget* widget;
 	struct wl_list link;
 };
 
+struct app_dir {
+	char* path;
+	struct wl_list link;
+};
+
+//A desktop file on disk, shadowed or not, kept so one can take over when the file hiding it goes away
+struct known_file {
+	char* path;
+	char* id;
+	struct wl_list link;
+};
+
+//The index is the header followed by the dirs, entries and actions arrays and then the string table
+struct index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t dir_count, entry_count, action_count;
+	uint32_t strings_size;
+	uint32_t locale, desktop;
+	uint32_t padding;
+};
+
+struct index_dir {
+	uint64_t dev, ino;
+	int64_t mtime_sec, mtime_nsec;
+	uint32_t path, parent;
+	uint32_t first_entry, entry_count;
+};
+
+struct index_entry {
+	uint32_t path, name, generic_name, icon, search_text;
+	uint32_t first_action, action_count;
+	uint32_t flags;
+};
+
+struct index_action {
+	uint32_t action, name;
+};
+
+enum index_flags {
+	INDEX_PARSED = 1,
+	INDEX_SHOWN = 2
+};
+
+struct parse_pool {
+	struct desktop_record** records;
+	size_t count, next;
+	pthread_mutex_t lock;
+};
+
+struct string_table {
+	char* data;
+	size_t size, capacity;
+};
+
 static struct map* entries;
 static struct wl_list desktop_entries;
+static struct wl_list widgets;
+//The nodes in widgets, freed in one go once wofi has taken the last one
+static struct utils_arena* node_arena;
+static struct wl_list scanned_dirs;
+static uint32_t scanned_dir_count;
+static struct map* records;
+static struct wl_list app_dirs;
+static struct map* watches;
+static int inotify_fd = -1;
+static struct wl_list known_files;
+static struct map* known_paths;
+
+static struct index_header* index_map = NULL;
+static size_t index_size;
+static struct index_dir* index_dirs;
+static struct index_entry* index_entries;
+static struct index_action* index_actions;
+static char* index_strings;
+static struct map* index_dir_map;
+static bool index_dirty;
 
 static bool print_command;
 static bool display_generic;
 static bool disable_prime;
 static bool print_desktop_file;
 
-static char* get_search_text(char* file) {
-	GDesktopAppInfo* info = g_desktop_app_info_new_from_filename(file);
+static struct node* new_node(void) {
+	if(node_arena == NULL) {
+		node_arena = utils_arena_new();
+	}
+	return utils_arena_alloc(node_arena, sizeof(struct node));
+}
+
+static void free_nodes(void) {
+	if(node_arena != NULL) {
+		utils_arena_free(node_arena);
+		node_arena = NULL;
+	}
+}
+
+static char* get_search_text(GDesktopAppInfo* info, const char* file) {
 	const char* name = g_app_info_get_display_name(G_APP_INFO(info));
 	const char* exec = g_app_info_get_executable(G_APP_INFO(info));
 	const char* description = g_app_info_get_description(G_APP_INFO(info));
@@ -75,114 +199,132 @@ static char* get_search_text(char* file) {
 	return ret;
 }
 
-static bool populate_widget(char* file, char* action, struct widget_builder* builder) {
-	GDesktopAppInfo* info = g_desktop_app_info_new_from_filename(file);
-	if(info == NULL || !g_app_info_should_show(G_APP_INFO(info)) ||
+static char* strdup_null(const char* str) {
+	return str == NULL ? NULL : strdup(str);
+}
+
+static struct desktop_record* new_record(const char* path) {
+	struct desktop_record* record = calloc(1, sizeof(struct desktop_record));
+	record->path = strdup(path);
+	record->owned = true;
+	wl_list_init(&record->link);
+	return record;
+}
+
+static void free_record(struct desktop_record* record) {
+	if(record->owned) {
+		free(record->path);
+		free(record->name);
+		free(record->generic_name);
+		free(record->icon);
+		free(record->search_text);
+		for(size_t count = 0; count < record->action_count; ++count) {
+			free(record->actions[count]);
+			free(record->action_names[count]);
+		}
+	}
+	free(record->actions);
+	free(record->action_names);
+	free(record);
+}
+
+static void parse_record(struct desktop_record* record) {
+	record->parsed = true;
+	GDesktopAppInfo* info = g_desktop_app_info_new_from_filename(record->path);
+	if(info == NULL) {
+		return;
+	}
+	const char* name = g_app_info_get_display_name(G_APP_INFO(info));
+	if(name == NULL || !g_app_info_should_show(G_APP_INFO(info)) ||
 			g_desktop_app_info_get_is_hidden(info)) {
-		return false;
+		g_object_unref(info);
+		return;
+	}
+
+	record->shown = true;
+	record->name = strdup(name);
+	record->generic_name = strdup_null(g_desktop_app_info_get_generic_name(info));
+	record->search_text = get_search_text(info, record->path);
+
+	GIcon* icon = g_app_info_get_icon(G_APP_INFO(info));
+	if(icon != NULL) {
+		gchar* icon_str = g_icon_to_string(icon);
+		record->icon = strdup_null(icon_str);
+		g_free(icon_str);
+	}
+
+	const gchar* const* actions = g_desktop_app_info_list_actions(info);
+	for(; actions[record->action_count] != NULL; ++record->action_count);
+	record->actions = malloc(record->action_count * sizeof(char*));
+	record->action_names = malloc(record->action_count * sizeof(char*));
+	for(size_t count = 0; count < record->action_count; ++count) {
+		gchar* action_name = g_desktop_app_info_get_action_name(info, actions[count]);
+		record->actions[count] = strdup(actions[count]);
+		record->action_names[count] = strdup_null(action_name);
+		g_free(action_name);
 	}
+
+	g_object_unref(info);
+}
+
+static void populate_widget(struct desktop_record* record, GIcon* icon, char* action, char* action_name, struct widget_builder* builder) {
 	const char* name;
 	char* generic_name = strdup("");
 	if(action == NULL) {
-		name = g_app_info_get_display_name(G_APP_INFO(info));
-		if(display_generic) {
-			const char* gname = g_desktop_app_info_get_generic_name(info);
-			if(gname != NULL) {
-				free(generic_name);
-				generic_name = utils_concat(3, " (", gname, ")");
-			}
+		name = record->name;
+		if(display_generic && record->generic_name != NULL) {
+			free(generic_name);
+			generic_name = utils_concat(3, " (", record->generic_name, ")");
 		}
 	} else {
-		name = g_desktop_app_info_get_action_name(info, action);
+		name = action_name;
 	}
 	if(name == NULL) {
 		free(generic_name);
-		return false;
+		return;
 	}
 
-
-
-	if(wofi_allow_images()) {
-		GIcon* icon = g_app_info_get_icon(G_APP_INFO(info));
-		GdkPixbuf* pixbuf;
-		if(G_IS_FILE_ICON(icon)) {
-			GFile* file = g_file_icon_get_file(G_FILE_ICON(icon));
-			char* path = g_file_get_path(file);
-			pixbuf = gdk_pixbuf_new_from_file(path, NULL);
-		} else {
-			GtkIconTheme* theme = gtk_icon_theme_get_default();
-			GtkIconInfo* info = NULL;
-			if(icon != NULL) {
-				const gchar* const* icon_names = g_themed_icon_get_names(G_THEMED_ICON(icon));
-				info = gtk_icon_theme_choose_icon_for_scale(theme, (const gchar**) icon_names, wofi_get_image_size(), wofi_get_window_scale(), 0);
-			}
-			if(info == NULL) {
-				info = gtk_icon_theme_lookup_icon_for_scale(theme, "application-x-executable", wofi_get_image_size(), wofi_get_window_scale(), 0);
-			}
-			pixbuf = gtk_icon_info_load_icon(info, NULL);
-		}
-
-		if(pixbuf == NULL) {
-			goto img_fail;
-		}
-
-		pixbuf = utils_g_resize_pixbuf(pixbuf, wofi_get_image_size() * wofi_get_window_scale(), GDK_INTERP_BILINEAR);
-
-		wofi_widget_builder_insert_image(builder, pixbuf, "icon", NULL);
-		g_object_unref(pixbuf);
+	if(icon != NULL) {
+		wofi_widget_builder_insert_icon(builder, icon, "icon", NULL);
 	}
 
-	img_fail:
 	wofi_widget_builder_insert_text(builder, name, "name", NULL);
 	wofi_widget_builder_insert_text(builder, generic_name, "generic-name", NULL);
 	free(generic_name);
 
 	if(action == NULL) {
-		wofi_widget_builder_set_action(builder, file);
+		wofi_widget_builder_set_action(builder, record->path);
 	} else {
-		char* action_txt = utils_concat(3, file, " ", action);
+		char* action_txt = utils_concat(3, record->path, " ", action);
 		wofi_widget_builder_set_action(builder, action_txt);
 		free(action_txt);
 	}
 
-
-	char* search_txt = get_search_text(file);
-	wofi_widget_builder_set_search_text(builder, search_txt);
-	free(search_txt);
-
-	return true;
-}
-
-static const gchar* const* get_actions(char* file, size_t* action_count) {
-	*action_count = 0;
-	GDesktopAppInfo* info = g_desktop_app_info_new_from_filename(file);
-	if(info == NULL) {
-		return NULL;
-	}
-	const gchar* const* actions = g_desktop_app_info_list_actions(info);
-	if(actions[0] == NULL) {
-		return NULL;
-	}
-
-	for(; actions[*action_count] != NULL; ++*action_count);
-
-	return actions;
+	wofi_widget_builder_set_search_text(builder, record->search_text);
 }
 
-static struct widget_builder* populate_actions(char* file, size_t* text_count) {
-	const gchar* const* action_names = get_actions(file, text_count);
-
-	++*text_count;
+static struct widget_builder* populate_actions(struct desktop_record* record, size_t* text_count) {
+	*text_count = record->action_count + 1;
 
+	GIcon* icon = NULL;
+	if(wofi_allow_images()) {
+		if(record->icon != NULL) {
+			icon = g_icon_new_for_string(record->icon, NULL);
+		}
+		if(icon == NULL) {
+			icon = g_themed_icon_new("application-x-executable");
+		}
+	}
 
 	struct widget_builder* builder = wofi_widget_builder_init(mode, *text_count);
-	if(!populate_widget(file, NULL, builder)) {
-		wofi_widget_builder_free(builder);
-		return NULL;
-	}
+	populate_widget(record, icon, NULL, NULL, builder);
 
 	for(size_t count = 1; count < *text_count; ++count) {
-		populate_widget(file, (gchar*) action_names[count - 1], wofi_widget_builder_get_idx(builder, count));
+		populate_widget(record, icon, record->actions[count - 1], record->action_names[count - 1], wofi_widget_builder_get_idx(builder, count));
+	}
+
+	if(icon != NULL) {
+		g_object_unref(icon);
 	}
 	return builder;
 }
@@ -202,77 +344,602 @@ static char* get_id(char* path) {
 	return id;
 }
 
-static struct widget* create_widget(char* full_path) {
-	char* id = get_id(full_path);
+static bool claim_entry(struct desktop_entry* entry) {
+	char* id = get_id(entry->full_path);
 	if(id == NULL) {
-		free(full_path);
-		return NULL;
+		return false;
 	}
 
 	if(map_contains(entries, id)) {
 		free(id);
-		free(full_path);
-		return NULL;
+		return false;
+	}
+
+	map_put(entries, id, entry->full_path);
+	free(id);
+
+	//Cached entries outside of the application directories aren't indexed, they're parsed every time
+	if(entry->record == NULL) {
+		entry->record = new_record(entry->full_path);
+		entry->owns_record = true;
+	}
+	return true;
+}
+
+static void* parse_worker(void* data) {
+	struct parse_pool* pool = data;
+	while(true) {
+		pthread_mutex_lock(&pool->lock);
+		size_t idx = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if(idx >= pool->count) {
+			break;
+		}
+		parse_record(pool->records[idx]);
+	}
+	return NULL;
+}
+
+static void parse_records(struct desktop_record** records, size_t record_count) {
+	struct parse_pool pool = {
+		.records = records,
+		.count = record_count,
+		.next = 0
+	};
+	pthread_mutex_init(&pool.lock, NULL);
+
+	size_t thread_count = g_get_num_processors();
+	if(thread_count > record_count) {
+		thread_count = record_count;
+	}
+
+	//The mode thread takes its share of the records as well instead of only waiting on the others
+	pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+	//Only the threads that actually started are joined, the calling thread gets through the work alone if need be
+	size_t started = 0;
+	for(size_t count = 1; count < thread_count; ++count) {
+		if(pthread_create(threads + started, NULL, parse_worker, &pool) != 0) {
+			break;
+		}
+		++started;
 	}
+	parse_worker(&pool);
+	for(size_t count = 0; count < started; ++count) {
+		pthread_join(threads[count], NULL);
+	}
+
+	free(threads);
+	pthread_mutex_destroy(&pool.lock);
+}
 
-	map_put(entries, id, "true");
+static struct widget* create_widget(struct desktop_entry* entry) {
+	struct desktop_record* record = entry->record;
+	if(!record->shown) {
+		wofi_remove_cache(mode, entry->full_path);
+		return NULL;
+	}
 
 	size_t action_count;
+	struct widget_builder* builder = populate_actions(record, &action_count);
+	return wofi_widget_builder_get_widget(builder);
+}
 
-	struct widget_builder* builder = populate_actions(full_path, &action_count);
-	if(builder == NULL) {
-		wofi_remove_cache(mode, full_path);
-		free(id);
-		free(full_path);
+static char* get_index_path(void) {
+	char* cache_path = (getenv("WOFI_CACHE_DIR") == NULL) ? getenv("XDG_CACHE_HOME") : getenv("WOFI_CACHE_DIR");
+	if(cache_path == NULL) {
+		return utils_concat(2, getenv("HOME"), "/.cache/wofi-drun-index");
+	}
+	return utils_concat(2, cache_path, "/wofi-drun-index");
+}
+
+static const char* get_locale(void) {
+	return g_get_language_names()[0];
+}
+
+static const char* get_desktop(void) {
+	char* desktop = getenv("XDG_CURRENT_DESKTOP");
+	return desktop == NULL ? "" : desktop;
+}
+
+static char* index_str(uint32_t offset) {
+	if(offset == INDEX_NONE || offset >= index_map->strings_size) {
 		return NULL;
 	}
+	return index_strings + offset;
+}
 
-	struct widget* ret = wofi_widget_builder_get_widget(builder);
+static bool index_str_eq(uint32_t offset, const char* str) {
+	char* index_string = index_str(offset);
+	return index_string != NULL && strcmp(index_string, str) == 0;
+}
 
-	free(id);
+static void unload_index(void) {
+	if(index_map != NULL) {
+		munmap(index_map, index_size);
+		index_map = NULL;
+	}
+}
+
+static void load_index(void) {
+	char* path = get_index_path();
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if(fd == -1) {
+		return;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) == -1 || (size_t) info.st_size < sizeof(struct index_header)) {
+		close(fd);
+		return;
+	}
+	void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		return;
+	}
+	index_map = data;
+	index_size = info.st_size;
+
+	size_t size = sizeof(struct index_header) + index_map->dir_count * sizeof(struct index_dir)
+		+ index_map->entry_count * sizeof(struct index_entry)
+		+ (size_t) index_map->action_count * sizeof(struct index_action);
+
+	if(memcmp(index_map->magic, INDEX_MAGIC, sizeof(index_map->magic)) != 0 || index_map->version != INDEX_VERSION
+			|| size + index_map->strings_size != index_size || index_map->strings_size == 0
+			|| ((char*) data)[index_size - 1] != 0) {
+		unload_index();
+		return;
+	}
+
+	index_dirs = (struct index_dir*) (index_map + 1);
+	index_entries = (struct index_entry*) (index_dirs + index_map->dir_count);
+	index_actions = (struct index_action*) (index_entries + index_map->entry_count);
+	index_strings = (char*) (index_actions + index_map->action_count);
+
+	//Names and visibility depend on the language and desktop, if either changed nothing in here can be trusted
+	if(!index_str_eq(index_map->locale, get_locale()) || !index_str_eq(index_map->desktop, get_desktop())) {
+		unload_index();
+		return;
+	}
+
+	for(uint32_t count = 0; count < index_map->dir_count; ++count) {
+		struct index_dir* dir = index_dirs + count;
+		if(index_str(dir->path) == NULL || dir->first_entry > index_map->entry_count
+				|| dir->entry_count > index_map->entry_count - dir->first_entry) {
+			unload_index();
+			return;
+		}
+	}
+	for(uint32_t count = 0; count < index_map->entry_count; ++count) {
+		struct index_entry* entry = index_entries + count;
+		if(index_str(entry->path) == NULL || entry->first_action > index_map->action_count
+				|| entry->action_count > index_map->action_count - entry->first_action) {
+			unload_index();
+			return;
+		}
+	}
+
+	for(uint32_t count = 0; count < index_map->dir_count; ++count) {
+		map_put_void(index_dir_map, index_str(index_dirs[count].path), index_dirs + count);
+	}
+}
+
+static struct desktop_record* load_record(struct index_entry* entry) {
+	struct desktop_record* record = calloc(1, sizeof(struct desktop_record));
+	record->path = index_str(entry->path);
+	record->parsed = (entry->flags & INDEX_PARSED) == INDEX_PARSED;
+	record->shown = (entry->flags & INDEX_SHOWN) == INDEX_SHOWN;
+	record->name = index_str(entry->name);
+	record->generic_name = index_str(entry->generic_name);
+	record->icon = index_str(entry->icon);
+	record->search_text = index_str(entry->search_text);
+	record->action_count = entry->action_count;
+	record->actions = malloc(record->action_count * sizeof(char*));
+	record->action_names = malloc(record->action_count * sizeof(char*));
+	for(size_t count = 0; count < record->action_count; ++count) {
+		struct index_action* action = index_actions + entry->first_action + count;
+		record->actions[count] = index_str(action->action);
+		record->action_names[count] = index_str(action->name);
+	}
+	if(record->shown && (record->name == NULL || record->search_text == NULL)) {
+		record->parsed = false;
+		record->shown = false;
+	}
+	return record;
+}
+
+static void add_record(struct scanned_dir* dir, struct desktop_record* record) {
+	wl_list_insert(dir->records.prev, &record->link);
+	map_put_void(records, record->path, record);
+}
+
+struct scan_state {
+	const char* path;
+	uint32_t idx;
+	struct scanned_dir* dir;
+};
+
+static void scan_dir(int at_fd, const char* name, const char* app_dir, uint32_t parent);
+
+static void scan_entry(int dir_fd, const char* name, bool is_dir, void* data) {
+	struct scan_state* state = data;
+	if(!is_dir && !g_str_has_suffix(name, ".desktop")) {
+		return;
+	}
+	char* full_path = utils_concat(3, state->path, "/", name);
+	if(is_dir) {
+		scan_dir(dir_fd, name, full_path, state->idx);
+	} else {
+		add_record(state->dir, new_record(full_path));
+	}
 	free(full_path);
+}
 
-	return ret;
+//Nix and similar store directories all share one fixed mtime, a profile switch only shows up as a different inode
+static bool index_dir_matches(struct index_dir* indexed, struct scanned_dir* dir) {
+	return indexed->dev == dir->dev && indexed->ino == dir->ino &&
+		indexed->mtime_sec == dir->mtime_sec && indexed->mtime_nsec == dir->mtime_nsec;
 }
 
-static void insert_dir(char* app_dir) {
-	DIR* dir = opendir(app_dir);
-	if(dir == NULL) {
+static void scan_dir(int at_fd, const char* name, const char* app_dir, uint32_t parent) {
+	int dir_fd = utils_open_dir(at_fd, name);
+	struct stat info;
+	if(dir_fd == -1 || fstat(dir_fd, &info) == -1) {
+		if(dir_fd != -1) {
+			close(dir_fd);
+		}
 		return;
 	}
-	struct dirent* entry;
-	while((entry = readdir(dir)) != NULL) {
-		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-			continue;
+
+	uint32_t idx = scanned_dir_count++;
+	struct scanned_dir* dir = malloc(sizeof(struct scanned_dir));
+	dir->path = strdup(app_dir);
+	dir->parent = parent;
+	dir->dev = info.st_dev;
+	dir->ino = info.st_ino;
+	dir->mtime_sec = info.st_mtim.tv_sec;
+	dir->mtime_nsec = info.st_mtim.tv_nsec;
+	wl_list_init(&dir->records);
+	wl_list_insert(scanned_dirs.prev, &dir->link);
+
+	struct index_dir* indexed = index_map == NULL ? NULL : map_get(index_dir_map, app_dir);
+	if(indexed != NULL && index_dir_matches(indexed, dir)) {
+		//Nothing was added or removed here since the index was written so there's no need to even list it
+		for(uint32_t count = 0; count < indexed->entry_count; ++count) {
+			add_record(dir, load_record(index_entries + indexed->first_entry + count));
 		}
-		char* full_path = utils_concat(3, app_dir, "/", entry->d_name);
-		char* id = get_id(full_path);
-		if(id == NULL) {
-			free(full_path);
-			continue;
+		uint32_t indexed_idx = indexed - index_dirs;
+		for(uint32_t count = 0; count < index_map->dir_count; ++count) {
+			if(index_dirs[count].parent == indexed_idx) {
+				char* path = index_str(index_dirs[count].path);
+				char* slash = strrchr(path, '/');
+				scan_dir(dir_fd, slash == NULL ? path : slash + 1, path, idx);
+			}
 		}
+		close(dir_fd);
+		return;
+	}
 
-		struct stat info;
-		stat(full_path, &info);
-		if(S_ISDIR(info.st_mode)) {
-			insert_dir(full_path);
-			free(id);
-			free(full_path);
-			continue;
+	index_dirty = true;
+
+	struct scan_state state = {
+		.path = app_dir,
+		.idx = idx,
+		.dir = dir
+	};
+	utils_scan_dir(dir_fd, UTILS_SCAN_FILES | UTILS_SCAN_DIRS, scan_entry, &state);
+}
+
+static uint32_t add_string(struct string_table* table, const char* str) {
+	if(str == NULL) {
+		return INDEX_NONE;
+	}
+	size_t len = strlen(str) + 1;
+	if(table->size + len > table->capacity) {
+		table->capacity = (table->size + len) * 2;
+		table->data = realloc(table->data, table->capacity);
+	}
+	uint32_t offset = table->size;
+	memcpy(table->data + offset, str, len);
+	table->size += len;
+	return offset;
+}
+
+static void write_index(void) {
+	uint32_t entry_count = 0, action_count = 0;
+	struct scanned_dir* dir;
+	struct desktop_record* record;
+	wl_list_for_each(dir, &scanned_dirs, link) {
+		wl_list_for_each(record, &dir->records, link) {
+			++entry_count;
+			action_count += record->action_count;
 		}
-		if(map_contains(entries, id)) {
-			free(id);
-			free(full_path);
-			continue;
+	}
+
+	struct index_header header = {0};
+	struct index_dir* dirs = calloc(scanned_dir_count, sizeof(struct index_dir));
+	struct index_entry* entries = calloc(entry_count, sizeof(struct index_entry));
+	struct index_action* actions = calloc(action_count, sizeof(struct index_action));
+	struct string_table strings = {0};
+
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = INDEX_VERSION;
+	header.dir_count = scanned_dir_count;
+	header.entry_count = entry_count;
+	header.action_count = action_count;
+	header.locale = add_string(&strings, get_locale());
+	header.desktop = add_string(&strings, get_desktop());
+
+	uint32_t dir_idx = 0, entry_idx = 0, action_idx = 0;
+	wl_list_for_each(dir, &scanned_dirs, link) {
+		struct index_dir* index_dir = dirs + dir_idx++;
+		index_dir->dev = dir->dev;
+		index_dir->ino = dir->ino;
+		index_dir->mtime_sec = dir->mtime_sec;
+		index_dir->mtime_nsec = dir->mtime_nsec;
+		index_dir->path = add_string(&strings, dir->path);
+		index_dir->parent = dir->parent;
+		index_dir->first_entry = entry_idx;
+		wl_list_for_each(record, &dir->records, link) {
+			struct index_entry* entry = entries + entry_idx++;
+			entry->path = add_string(&strings, record->path);
+			entry->name = add_string(&strings, record->name);
+			entry->generic_name = add_string(&strings, record->generic_name);
+			entry->icon = add_string(&strings, record->icon);
+			entry->search_text = add_string(&strings, record->search_text);
+			entry->flags = (record->parsed ? INDEX_PARSED : 0) | (record->shown ? INDEX_SHOWN : 0);
+			entry->first_action = action_idx;
+			entry->action_count = record->action_count;
+			for(size_t count = 0; count < record->action_count; ++count) {
+				struct index_action* action = actions + action_idx++;
+				action->action = add_string(&strings, record->actions[count]);
+				action->name = add_string(&strings, record->action_names[count]);
+			}
+		}
+		index_dir->entry_count = entry_idx - index_dir->first_entry;
+	}
+	header.strings_size = strings.size;
+
+	//Written next to the real index and renamed over it so a concurrent wofi never maps a partial file
+	char* path = get_index_path();
+	char* tmp_path = utils_concat(2, path, ".XXXXXX");
+	int fd = mkstemp(tmp_path);
+	FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+	if(file != NULL) {
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = ok && fwrite(dirs, sizeof(struct index_dir), scanned_dir_count, file) == scanned_dir_count;
+		ok = ok && fwrite(entries, sizeof(struct index_entry), entry_count, file) == entry_count;
+		ok = ok && fwrite(actions, sizeof(struct index_action), action_count, file) == action_count;
+		ok = ok && fwrite(strings.data, 1, strings.size, file) == strings.size;
+		ok = fclose(file) == 0 && ok;
+		if(!ok || rename(tmp_path, path) == -1) {
+			unlink(tmp_path);
+		}
+	} else if(fd != -1) {
+		close(fd);
+		unlink(tmp_path);
+	}
+
+	free(tmp_path);
+	free(path);
+	free(dirs);
+	free(entries);
+	free(actions);
+	free(strings.data);
+}
+
+static void free_scanned_dirs(void) {
+	struct scanned_dir* dir, *tmp_dir;
+	wl_list_for_each_safe(dir, tmp_dir, &scanned_dirs, link) {
+		struct desktop_record* record, *tmp_record;
+		wl_list_for_each_safe(record, tmp_record, &dir->records, link) {
+			free_record(record);
+		}
+		free(dir->path);
+		free(dir);
+	}
+}
+
+static void add_watch(const char* dir) {
+	int wd = inotify_add_watch(inotify_fd, dir, WATCH_EVENTS);
+	if(wd == -1) {
+		return;
+	}
+	char wd_str[11];
+	snprintf(wd_str, sizeof(wd_str), "%d", wd);
+	map_put(watches, wd_str, (char*) dir);
+}
+
+static void add_known(const char* path, const char* id) {
+	if(map_contains(known_paths, path)) {
+		return;
+	}
+	struct known_file* file = malloc(sizeof(struct known_file));
+	file->path = strdup(path);
+	file->id = strdup(id);
+	wl_list_insert(known_files.prev, &file->link);
+	map_put_void(known_paths, path, file);
+}
+
+static void free_known(struct known_file* file) {
+	map_put_void(known_paths, file->path, NULL);
+	wl_list_remove(&file->link);
+	free(file->path);
+	free(file->id);
+	free(file);
+}
+
+static size_t get_dir_rank(const char* path) {
+	size_t rank = 0;
+	struct app_dir* app_dir;
+	wl_list_for_each(app_dir, &app_dirs, link) {
+		size_t len = strlen(app_dir->path);
+		if(strncmp(path, app_dir->path, len) == 0 && path[len] == '/') {
+			return rank;
 		}
+		++rank;
+	}
+	return rank;
+}
+
+static void update_entry(char* path) {
+	char* id = get_id(path);
+	if(id == NULL) {
+		return;
+	}
+	add_known(path, id);
+
+	//The same id in an earlier data dir takes priority, just like on startup
+	char* current = map_get(entries, id);
+	if(current != NULL && strcmp(current, path) != 0 && get_dir_rank(current) < get_dir_rank(path)) {
+		free(id);
+		return;
+	}
+	if(current != NULL) {
+		wofi_remove_widget(mode, current);
+	}
+	map_put(entries, id, path);
+	free(id);
+
+	struct desktop_record* record = new_record(path);
+	parse_record(record);
+	if(record->shown) {
+		size_t action_count;
+		struct node* node = new_node();
+		node->widget = wofi_widget_builder_get_widget(populate_actions(record, &action_count));
+		wl_list_insert(widgets.prev, &node->link);
+		wofi_insert_widgets(mode);
+	}
+	free_record(record);
+}
+
+static void remove_entry(char* path) {
+	struct known_file* known = map_get(known_paths, path);
+	if(known != NULL) {
+		free_known(known);
+	}
 
-		struct desktop_entry* entry = malloc(sizeof(struct desktop_entry));
-		entry->full_path = full_path;
-		wl_list_insert(&desktop_entries, &entry->link);
+	char* id = get_id(path);
+	if(id == NULL) {
+		return;
+	}
 
+	char* current = map_get(entries, id);
+	if(current == NULL || strcmp(current, path) != 0) {
 		free(id);
+		return;
+	}
+	wofi_remove_widget(mode, path);
+	map_put(entries, id, NULL);
+
+	//An entry with the same id that this one was hiding can show up now, its path can't be rebuilt from the id since a '-' may have been a '/'
+	struct known_file* candidate = NULL, *file;
+	wl_list_for_each(file, &known_files, link) {
+		if(strcmp(file->id, id) == 0 && access(file->path, F_OK) == 0 &&
+				(candidate == NULL || get_dir_rank(file->path) < get_dir_rank(candidate->path))) {
+			candidate = file;
+		}
+	}
+	if(candidate != NULL) {
+		update_entry(candidate->path);
+	}
+	free(id);
+}
+
+//Nothing is reported for the files in a directory that's moved away so everything known under it goes at once
+static void remove_dir_entries(const char* dir) {
+	size_t len = strlen(dir);
+	struct wl_list removed;
+	wl_list_init(&removed);
+	struct known_file* file, *tmp;
+	wl_list_for_each_safe(file, tmp, &known_files, link) {
+		if(strncmp(file->path, dir, len) == 0 && file->path[len] == '/') {
+			wl_list_remove(&file->link);
+			wl_list_insert(removed.prev, &file->link);
+		}
+	}
+
+	//They're all out of the known files first so none of them is picked to replace another
+	wl_list_for_each_safe(file, tmp, &removed, link) {
+		char* path = strdup(file->path);
+		free_known(file);
+		remove_entry(path);
+		free(path);
+	}
+}
+
+static void add_file_entry(int dir_fd, const char* name, bool is_dir, void* data) {
+	(void) dir_fd;
+	(void) is_dir;
+	if(g_str_has_suffix(name, ".desktop")) {
+		char* full_path = utils_concat(3, data, "/", name);
+		update_entry(full_path);
+		free(full_path);
+	}
+}
+
+static void add_dir_entries(char* dir_path) {
+	add_watch(dir_path);
+	int dir_fd = utils_open_dir(AT_FDCWD, dir_path);
+	if(dir_fd != -1) {
+		utils_scan_dir(dir_fd, UTILS_SCAN_FILES, add_file_entry, dir_path);
+	}
+}
+
+static gboolean handle_watch(gint fd, GIOCondition condition, gpointer data) {
+	(void) condition;
+	(void) data;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while((len = read(fd, buf, sizeof(buf))) > 0) {
+		struct inotify_event* event;
+		for(char* ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event*) ptr;
+			char wd_str[11];
+			snprintf(wd_str, sizeof(wd_str), "%d", event->wd);
+			char* dir = map_get(watches, wd_str);
+			if(dir == NULL) {
+				continue;
+			}
+			if(event->mask & IN_IGNORED) {
+				map_put(watches, wd_str, NULL);
+				continue;
+			}
+			if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				//Application dirs have no watched parent to report this, a renamed subdirectory may already have this wd for its new path
+				if(access(dir, F_OK) != 0) {
+					remove_dir_entries(dir);
+					inotify_rm_watch(fd, event->wd);
+				}
+				continue;
+			}
+			if(event->len == 0) {
+				continue;
+			}
+
+			char* full_path = utils_concat(3, dir, "/", event->name);
+			if(event->mask & IN_ISDIR) {
+				if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+					add_dir_entries(full_path);
+				} else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+					remove_dir_entries(full_path);
+				}
+			} else if(g_str_has_suffix(event->name, ".desktop")) {
+				struct stat info;
+				if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+					remove_entry(full_path);
+				} else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+					update_entry(full_path);
+				} else if(lstat(full_path, &info) == 0 && S_ISLNK(info.st_mode)) {
+					//Symlinks never get written to, they're complete as soon as they're created
+					update_entry(full_path);
+				}
+			}
+			free(full_path);
+		}
 	}
-	closedir(dir);
+	return G_SOURCE_CONTINUE;
 }
 
 static char*
@@ -337,66 +1004,162 @@ static bool should_invalidate_cache(char* path) {
 	return false;
 }
 
-void wofi_drun_init(struct mode* this, struct map* config) {
+static void read_args(struct mode* this, struct map* config) {
 	mode = this;
-
 	print_command = strcmp(config_get(config, "print_command", "false"), "true") == 0;
 	display_generic = strcmp(config_get(config, "display_generic", "false"), "true") == 0;
 	disable_prime = strcmp(config_get(config, "disable_prime", "false"), "true") == 0;
 	print_desktop_file = strcmp(config_get(config, "print_desktop_file", "false"), "true") == 0;
+}
+
+void wofi_drun_exec_init(struct mode* this, struct map* config) {
+	read_args(this, config);
+}
+
+void wofi_drun_init(struct mode* this, struct map* config) {
+	read_args(this, config);
 
 	entries = map_init();
+	records = map_init_void();
+	index_dir_map = map_init_void();
+	wl_list_init(&scanned_dirs);
+	wl_list_init(&desktop_entries);
+
+	load_index();
+	index_dirty = index_map == NULL;
+
+	char* data_home = get_data_home();
+	char* data_dirs = get_data_dirs();
+	char* dirs = utils_concat(3, data_home, ":", data_dirs);
+	free(data_home);
+	free(data_dirs);
+
+	wl_list_init(&app_dirs);
+	char* save_ptr;
+	char* str = strtok_r(dirs, ":", &save_ptr);
+	do {
+		struct app_dir* app_dir = malloc(sizeof(struct app_dir));
+		app_dir->path = utils_concat(2, str, "/applications");
+		wl_list_insert(app_dirs.prev, &app_dir->link);
+		scan_dir(AT_FDCWD, app_dir->path, app_dir->path, INDEX_NONE);
+	} while((str = strtok_r(NULL, ":", &save_ptr)) != NULL);
+	free(dirs);
+
+	//A directory that went away doesn't show up as a changed one
+	if(index_map != NULL && index_map->dir_count != scanned_dir_count) {
+		index_dirty = true;
+	}
+
 	struct wl_list* cache = wofi_read_cache(mode);
 
-	wl_list_init(&desktop_entries);
+	//The entries are only needed until their widgets are built so they're all freed together afterwards
+	struct utils_arena* entry_arena = utils_arena_new();
 
 	struct cache_line* node, *tmp;
 	wl_list_for_each_safe(node, tmp, cache, link) {
 		if(should_invalidate_cache(node->line)) {
 			wofi_remove_cache(mode, node->line);
-			free(node->line);
 			goto cache_cont;
 		}
 
-		struct desktop_entry* entry = malloc(sizeof(struct desktop_entry));
-		entry->full_path = node->line;
-		wl_list_insert(&desktop_entries, &entry->link);
+		struct desktop_entry* entry = utils_arena_alloc(entry_arena, sizeof(struct desktop_entry));
+		entry->full_path = utils_arena_strdup(entry_arena, node->line);
+		entry->record = map_get(records, node->line);
+		entry->owns_record = false;
+		wl_list_insert(desktop_entries.prev, &entry->link);
 
 		cache_cont:
+		free(node->line);
 		wl_list_remove(&node->link);
 		free(node);
 	}
 
 	free(cache);
 
-	char* data_home = get_data_home();
-	char* data_dirs = get_data_dirs();
-	char* dirs = utils_concat(3, data_home, ":", data_dirs);
-	free(data_home);
-	free(data_dirs);
-
-	char* save_ptr;
-	char* str = strtok_r(dirs, ":", &save_ptr);
-	do {
-		char* app_dir = utils_concat(2, str, "/applications");
-		insert_dir(app_dir);
-		free(app_dir);
-	} while((str = strtok_r(NULL, ":", &save_ptr)) != NULL);
-	free(dirs);
-}
+	struct scanned_dir* dir;
+	wl_list_for_each(dir, &scanned_dirs, link) {
+		struct desktop_record* record;
+		wl_list_for_each(record, &dir->records, link) {
+			struct desktop_entry* entry = utils_arena_alloc(entry_arena, sizeof(struct desktop_entry));
+			entry->full_path = utils_arena_strdup(entry_arena, record->path);
+			entry->record = record;
+			entry->owns_record = false;
+			wl_list_insert(desktop_entries.prev, &entry->link);
+		}
+	}
 
-struct widget* wofi_drun_get_widget(void) {
-	struct desktop_entry* node, *tmp;
-	wl_list_for_each_reverse_safe(node, tmp, &desktop_entries, link) {
-		struct widget* widget = create_widget(node->full_path);
-		wl_list_remove(&node->link);
-		free(node);
+	//Duplicates are dropped up front so that everything left to parse can be parsed in parallel
+	struct desktop_record** pending = malloc(wl_list_length(&desktop_entries) * sizeof(struct desktop_record*));
+	size_t pending_count = 0;
+	struct desktop_entry* entry, *tmp_entry;
+	wl_list_for_each_safe(entry, tmp_entry, &desktop_entries, link) {
+		if(!claim_entry(entry)) {
+			wl_list_remove(&entry->link);
+			continue;
+		}
+		if(!entry->record->parsed) {
+			pending[pending_count++] = entry->record;
+			index_dirty = index_dirty || !entry->owns_record;
+		}
+	}
+	parse_records(pending, pending_count);
+	free(pending);
+
+	//The entries are fully built here on the mode thread in their cache order, only the GTK widgets are left to the main thread
+	wl_list_init(&widgets);
+	wl_list_for_each_safe(entry, tmp_entry, &desktop_entries, link) {
+		struct widget* widget = create_widget(entry);
+		if(entry->owns_record) {
+			free_record(entry->record);
+		}
+		wl_list_remove(&entry->link);
 		if(widget == NULL) {
 			continue;
 		}
-		return widget;
+		struct node* node = new_node();
+		node->widget = widget;
+		wl_list_insert(widgets.prev, &node->link);
 	}
-	return NULL;
+	utils_arena_free(entry_arena);
+
+	if(index_dirty) {
+		write_index();
+	}
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(inotify_fd != -1) {
+		watches = map_init();
+		wl_list_init(&known_files);
+		known_paths = map_init_void();
+		wl_list_for_each(dir, &scanned_dirs, link) {
+			add_watch(dir->path);
+			struct desktop_record* record;
+			wl_list_for_each(record, &dir->records, link) {
+				char* id = get_id(record->path);
+				if(id != NULL) {
+					add_known(record->path, id);
+					free(id);
+				}
+			}
+		}
+		g_unix_fd_add(inotify_fd, G_IO_IN, handle_watch, NULL);
+	}
+
+	free_scanned_dirs();
+	map_free(records);
+	map_free(index_dir_map);
+	unload_index();
+}
+
+struct widget* wofi_drun_get_widget(void) {
+	if(wl_list_empty(&widgets)) {
+		free_nodes();
+		return NULL;
+	}
+	struct node* node = wl_container_of(widgets.next, node, link);
+	struct widget* widget = node->widget;
+	wl_list_remove(&node->link);
+	return widget;
 }
 
 static void launch_done(GObject* obj, GAsyncResult* result, gpointer data) {
@@ -446,49 +1209,51 @@ static char* get_cmd(GAppInfo* info) {
 }
 
 void wofi_drun_exec(const gchar* cmd) {
-	GDesktopAppInfo* info = g_desktop_app_info_new_from_filename(cmd);
-	if(G_IS_DESKTOP_APP_INFO(info)) {
-		wofi_write_cache(mode, cmd);
-		if(print_command) {
-			char* cmd = get_cmd(G_APP_INFO(info));
-			printf("%s\n", cmd);
-			free(cmd);
-			wofi_exit(0);
-		} else if(print_desktop_file) {
-			printf("%s\n", cmd);
-			wofi_exit(0);
-		} else {
-			set_dri_prime(info);
-			if(uses_dbus(info)) {
-				g_app_info_launch_uris_async(G_APP_INFO(info), NULL, NULL, NULL, launch_done, (gchar*) cmd);
-			} else {
-				g_app_info_launch_uris(G_APP_INFO(info), NULL, NULL, NULL);
-				wofi_exit(0);
-			}
-		}
-	} else if(strrchr(cmd, ' ') != NULL) {
-		char* space = strrchr(cmd, ' ');
+	//Actions are passed as the path followed by a space and the action name
+	char* file = strdup(cmd);
+	char* action = NULL;
+	char* space = strrchr(file, ' ');
+	if(space != NULL && access(file, F_OK) != 0) {
 		*space = 0;
-		wofi_write_cache(mode, cmd);
-		info = g_desktop_app_info_new_from_filename(cmd);
-		char* action = space + 1;
-		if(print_command) {
-			char* cmd = get_cmd(G_APP_INFO(info));
-			printf("%s\n", cmd);
-			free(cmd);
+		action = space + 1;
+	}
+
+	GDesktopAppInfo* info = g_desktop_app_info_new_from_filename(file);
+	if(!G_IS_DESKTOP_APP_INFO(info)) {
+		fprintf(stderr, "%s cannot be executed\n", cmd);
+		wofi_exit(1);
+	}
+
+	wofi_write_cache(mode, file);
+	if(print_command) {
+		char* cmd = get_cmd(G_APP_INFO(info));
+		printf("%s\n", cmd);
+		free(cmd);
+		if(action != NULL) {
 			fprintf(stderr, "Printing the command line for an action is not supported\n");
-		} else if(print_desktop_file) {
-			printf("%s %s\n", cmd, action);
-			wofi_exit(0);
+		}
+	} else if(print_desktop_file) {
+		if(action == NULL) {
+			printf("%s\n", file);
 		} else {
-			set_dri_prime(info);
-			g_desktop_app_info_launch_action(info, action, NULL);
+			printf("%s %s\n", file, action);
 		}
-		wofi_exit(0);
 	} else {
-		fprintf(stderr, "%s cannot be executed\n", cmd);
-		wofi_exit(1);
+		set_dri_prime(info);
+		if(action != NULL) {
+			g_desktop_app_info_launch_action(info, action, NULL);
+		} else if(uses_dbus(info)) {
+			//The launch callback exits once activation is done, this doesn't return so the info and path stay around until then
+			g_app_info_launch_uris_async(G_APP_INFO(info), NULL, NULL, NULL, launch_done, file);
+			GMainLoop* loop = g_main_loop_new(NULL, FALSE);
+			g_main_loop_run(loop);
+		} else {
+			g_app_info_launch_uris(G_APP_INFO(info), NULL, NULL, NULL);
+		}
 	}
+	g_object_unref(info);
+	free(file);
+	wofi_exit(0);
 }
 
 const char** wofi_drun_get_arg_names(void) {
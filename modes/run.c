@@ -17,24 +17,47 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include <utils.h>
 #include <config.h>
 #include <wofi_api.h>
 
-static const char* arg_names[] = {"always_parse_args", "show_all", "print_command"};
+#include <glib-unix.h>
+
+#define SCAN_THREADS 8
+#define LISTING_VERSION "2"
+
+static const char* arg_names[] = {"always_parse_args", "show_all", "print_command", "path_cache_stats"};
 
 static bool always_parse_args;
 static bool show_all;
 static bool print_command;
+static bool path_cache_stats;
 static struct mode* mode;
 static const char* arg_str = "__args";
+static struct map* entries;
+static struct map* shown;
+static struct wl_list shown_entries;
+static struct map* watches;
+static int inotify_fd = -1;
+//The PATH directories in PATH order, with show_all off a name is looked up in them again when the executable shown for it goes away
+static char** path_dirs;
+static size_t path_dir_count;
+
+//Everything that has a widget, listed so the entries of a directory that goes away can be found
+struct shown_entry {
+	char* path;
+	struct wl_list link;
+};
 
 struct node {
 	struct widget* widget;
@@ -42,19 +65,433 @@ struct node {
 };
 
 static struct wl_list widgets;
+//Nodes are only needed until wofi takes their widget so they're freed together once the list runs dry
+static struct utils_arena* node_arena;
+
+//The executables found in one PATH directory, valid for as long as the directory's inode and mtime don't change
+struct path_listing {
+	char* path;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	size_t count;
+	char** names;
+	bool owned;
+	bool used;
+	struct wl_list link;
+};
 
-void wofi_run_init(struct mode* this, struct map* config) {
+//One PATH entry, resolved and listed on one of the scan threads
+struct path_job {
+	char* dir;
+	char* real_path;
+	//Kept open until the merge so the names can be checked relative to it
+	int dir_fd;
+	struct path_listing* cached;
+	struct path_listing* listing;
+};
+
+struct path_pool {
+	struct path_job* jobs;
+	struct map* by_path;
+	size_t count, next;
+	pthread_mutex_t lock;
+};
+
+static struct wl_list listings;
+static char* listing_data;
+
+static struct node* new_node(void) {
+	if(node_arena == NULL) {
+		node_arena = utils_arena_new();
+	}
+	return utils_arena_alloc(node_arena, sizeof(struct node));
+}
+
+static void free_nodes(void) {
+	if(node_arena != NULL) {
+		utils_arena_free(node_arena);
+		node_arena = NULL;
+	}
+}
+
+static bool is_executable(const char* path) {
+	struct stat info;
+	return stat(path, &info) == 0 && S_ISREG(info.st_mode) && access(path, X_OK) == 0;
+}
+
+static void mark_shown(const char* full_path) {
+	struct shown_entry* entry = malloc(sizeof(struct shown_entry));
+	entry->path = strdup(full_path);
+	wl_list_insert(shown_entries.prev, &entry->link);
+	map_put_void(shown, full_path, entry);
+}
+
+static void add_entry(char* full_path) {
+	char* text = strrchr(full_path, '/') + 1;
+	if(map_contains(shown, full_path) || (!show_all && map_contains(entries, text))) {
+		return;
+	}
+	mark_shown(full_path);
+	map_put(entries, text, full_path);
+	struct node* widget = new_node();
+	widget->widget = wofi_create_widget(mode, &text, text, &full_path, 1);
+	wl_list_insert(&widgets, &widget->link);
+	wofi_insert_widgets(mode);
+}
+
+static void remove_entry(char* full_path) {
+	//Most events are for files that were never shown, those don't need to go looking through the widgets
+	struct shown_entry* entry = map_get(shown, full_path);
+	if(entry == NULL) {
+		return;
+	}
+	wofi_remove_widget(mode, full_path);
+	map_put_void(shown, full_path, NULL);
+	wl_list_remove(&entry->link);
+	free(entry->path);
+	free(entry);
+
+	char* text = strrchr(full_path, '/') + 1;
+	char* current = map_get(entries, text);
+	if(current == NULL || strcmp(current, full_path) != 0) {
+		return;
+	}
+	map_put(entries, text, NULL);
+
+	//This was hiding any executable with the same name later in PATH
+	if(show_all) {
+		return;
+	}
+	for(size_t count = 0; count < path_dir_count; ++count) {
+		char* candidate = utils_concat(3, path_dirs[count], "/", text);
+		bool found = is_executable(candidate);
+		if(found) {
+			add_entry(candidate);
+		}
+		free(candidate);
+		if(found) {
+			break;
+		}
+	}
+}
+
+static void remove_dir_entries(const char* dir) {
+	size_t len = strlen(dir);
+	struct shown_entry* entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &shown_entries, link) {
+		if(strncmp(entry->path, dir, len) == 0 && entry->path[len] == '/') {
+			char* path = strdup(entry->path);
+			remove_entry(path);
+			free(path);
+		}
+	}
+}
+
+static gboolean handle_watch(gint fd, GIOCondition condition, gpointer data) {
+	(void) condition;
+	(void) data;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while((len = read(fd, buf, sizeof(buf))) > 0) {
+		struct inotify_event* event;
+		for(char* ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event*) ptr;
+			char wd_str[11];
+			snprintf(wd_str, sizeof(wd_str), "%d", event->wd);
+			char* dir = map_get(watches, wd_str);
+			if(dir == NULL) {
+				continue;
+			}
+			if(event->mask & IN_IGNORED) {
+				map_put(watches, wd_str, NULL);
+				continue;
+			}
+			if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				//Wherever a moved directory ended up it isn't the one in PATH anymore so the watch isn't kept either
+				remove_dir_entries(dir);
+				inotify_rm_watch(fd, event->wd);
+				continue;
+			}
+			if(event->len == 0 || (event->mask & IN_ISDIR)) {
+				continue;
+			}
+
+			char* full_path = utils_concat(3, dir, "/", event->name);
+			//A chmod or a rewrite can make something stop being executable as well as start
+			if(!(event->mask & (IN_DELETE | IN_MOVED_FROM)) && is_executable(full_path)) {
+				add_entry(full_path);
+			} else {
+				remove_entry(full_path);
+			}
+			free(full_path);
+		}
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static void add_watch(const char* dir) {
+	int wd = inotify_add_watch(inotify_fd, dir, IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+	if(wd == -1) {
+		return;
+	}
+	char wd_str[11];
+	snprintf(wd_str, sizeof(wd_str), "%d", wd);
+	map_put(watches, wd_str, (char*) dir);
+}
+
+static char* get_path_cache_path(void) {
+	char* cache_path = (getenv("WOFI_CACHE_DIR") == NULL) ? getenv("XDG_CACHE_HOME") : getenv("WOFI_CACHE_DIR");
+	if(cache_path == NULL) {
+		return utils_concat(2, getenv("HOME"), "/.cache/wofi-run-paths");
+	}
+	return utils_concat(2, cache_path, "/wofi-run-paths");
+}
+
+//The cache is a list of NUL terminated strings starting with the version, each directory is its path, a header with the inode, mtime and name count then the names
+//Only the names of regular files are cached, a chmod doesn't touch the directory's mtime so whether they're executable is checked every time
+static void load_listings(struct map* by_path) {
+	char* path = get_path_cache_path();
+	FILE* file = fopen(path, "r");
+	free(path);
+	if(file == NULL) {
+		return;
+	}
+
+	struct stat info;
+	if(fstat(fileno(file), &info) == -1 || info.st_size == 0) {
+		fclose(file);
+		return;
+	}
+	size_t size = info.st_size;
+	listing_data = malloc(size + 1);
+	if(fread(listing_data, 1, size, file) != size) {
+		size = 0;
+	}
+	fclose(file);
+	listing_data[size] = 0;
+
+	char* end = listing_data + size;
+	char* ptr = listing_data;
+	if(strcmp(ptr, LISTING_VERSION) != 0) {
+		return;
+	}
+	ptr += strlen(ptr) + 1;
+	while(ptr < end) {
+		char* dir_path = ptr;
+		ptr += strlen(ptr) + 1;
+		if(ptr >= end) {
+			break;
+		}
+
+		uint64_t ino;
+		int64_t mtime_sec, mtime_nsec;
+		size_t count;
+		if(sscanf(ptr, "%" SCNu64 " %" SCNd64 " %" SCNd64 " %zu", &ino, &mtime_sec, &mtime_nsec, &count) != 4 || count > size) {
+			break;
+		}
+		ptr += strlen(ptr) + 1;
+
+		char** names = malloc(count * sizeof(char*));
+		size_t idx;
+		for(idx = 0; idx < count && ptr < end; ++idx) {
+			names[idx] = ptr;
+			ptr += strlen(ptr) + 1;
+		}
+		if(idx < count) {
+			free(names);
+			break;
+		}
+
+		struct path_listing* listing = calloc(1, sizeof(struct path_listing));
+		listing->path = dir_path;
+		listing->ino = ino;
+		listing->mtime_sec = mtime_sec;
+		listing->mtime_nsec = mtime_nsec;
+		listing->count = count;
+		listing->names = names;
+		wl_list_insert(listings.prev, &listing->link);
+		map_put_void(by_path, dir_path, listing);
+	}
+}
+
+static bool listing_matches(struct path_listing* listing, struct stat* info) {
+	return listing->ino == (uint64_t) info->st_ino &&
+		listing->mtime_sec == (int64_t) info->st_mtim.tv_sec &&
+		listing->mtime_nsec == (int64_t) info->st_mtim.tv_nsec;
+}
+
+static void add_name(int dir_fd, const char* name, bool is_dir, void* data) {
+	(void) dir_fd;
+	(void) is_dir;
+	struct path_listing* listing = data;
+	if((listing->count & (listing->count - 1)) == 0) {
+		listing->names = realloc(listing->names, (listing->count == 0 ? 1 : listing->count * 2) * sizeof(char*));
+	}
+	listing->names[listing->count++] = strdup(name);
+}
+
+static struct path_listing* list_dir(int dir_fd, const char* path, struct stat* info) {
+	struct path_listing* listing = calloc(1, sizeof(struct path_listing));
+	listing->path = strdup(path);
+	listing->ino = info->st_ino;
+	listing->mtime_sec = info->st_mtim.tv_sec;
+	listing->mtime_nsec = info->st_mtim.tv_nsec;
+	listing->owned = true;
+	utils_scan_dir(dir_fd, UTILS_SCAN_FILES, add_name, listing);
+	return listing;
+}
+
+static void scan_path(struct path_job* job, struct map* by_path) {
+	job->real_path = realpath(job->dir, NULL);
+	if(job->real_path == NULL) {
+		return;
+	}
+	int dir_fd = utils_open_dir(AT_FDCWD, job->real_path);
+	struct stat info;
+	if(dir_fd == -1 || fstat(dir_fd, &info) == -1) {
+		if(dir_fd != -1) {
+			close(dir_fd);
+		}
+		return;
+	}
+
+	struct path_listing* cached = map_get(by_path, job->real_path);
+	if(cached != NULL && listing_matches(cached, &info)) {
+		job->cached = cached;
+		job->dir_fd = dir_fd;
+		return;
+	}
+
+	//utils_scan_dir closes the fd it's given, the job keeps its own open for the merge
+	int scan_fd = dup(dir_fd);
+	if(scan_fd == -1) {
+		close(dir_fd);
+		return;
+	}
+	job->dir_fd = dir_fd;
+	job->listing = list_dir(scan_fd, job->real_path, &info);
+}
+
+static void* path_worker(void* data) {
+	struct path_pool* pool = data;
+	while(true) {
+		pthread_mutex_lock(&pool->lock);
+		size_t idx = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if(idx >= pool->count) {
+			break;
+		}
+		scan_path(pool->jobs + idx, pool->by_path);
+	}
+	return NULL;
+}
+
+//Directories are mostly waiting on the filesystem so this isn't tied to the number of cores
+static void scan_paths(struct path_job* jobs, size_t job_count, struct map* by_path) {
+	struct path_pool pool = {
+		.jobs = jobs,
+		.by_path = by_path,
+		.count = job_count,
+		.next = 0
+	};
+	pthread_mutex_init(&pool.lock, NULL);
+
+	size_t thread_count = utils_min(SCAN_THREADS, job_count);
+	pthread_t threads[SCAN_THREADS];
+	//Only threads that started are joined, the mode thread can scan every directory by itself if none did
+	size_t started = 0;
+	for(size_t count = 1; count < thread_count; ++count) {
+		if(pthread_create(threads + started, NULL, path_worker, &pool) != 0) {
+			break;
+		}
+		++started;
+	}
+	path_worker(&pool);
+	for(size_t count = 0; count < started; ++count) {
+		pthread_join(threads[count], NULL);
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+}
+
+static void free_listing(struct path_listing* listing) {
+	if(listing->owned) {
+		free(listing->path);
+		for(size_t count = 0; count < listing->count; ++count) {
+			free(listing->names[count]);
+		}
+	}
+	free(listing->names);
+	free(listing);
+}
+
+static void write_listings(void) {
+	char* path = get_path_cache_path();
+	char* tmp_path = utils_concat(2, path, ".XXXXXX");
+	int fd = mkstemp(tmp_path);
+	FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+	if(file != NULL) {
+		bool ok = fwrite(LISTING_VERSION, 1, sizeof(LISTING_VERSION), file) == sizeof(LISTING_VERSION);
+		struct path_listing* listing;
+		wl_list_for_each(listing, &listings, link) {
+			if(!listing->used) {
+				continue;
+			}
+			ok = ok && fprintf(file, "%s%c%" PRIu64 " %" PRId64 " %" PRId64 " %zu%c", listing->path, 0,
+					listing->ino, listing->mtime_sec, listing->mtime_nsec, listing->count, 0) > 0;
+			for(size_t count = 0; count < listing->count && ok; ++count) {
+				ok = fwrite(listing->names[count], 1, strlen(listing->names[count]) + 1, file) == strlen(listing->names[count]) + 1;
+			}
+		}
+		ok = fclose(file) == 0 && ok;
+		if(!ok || rename(tmp_path, path) == -1) {
+			unlink(tmp_path);
+		}
+	} else if(fd != -1) {
+		close(fd);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	free(path);
+}
+
+static void free_listings(void) {
+	struct path_listing* listing, *tmp;
+	wl_list_for_each_safe(listing, tmp, &listings, link) {
+		wl_list_remove(&listing->link);
+		free_listing(listing);
+	}
+	free(listing_data);
+	listing_data = NULL;
+}
+
+static void read_args(struct mode* this, struct map* config) {
 	mode = this;
 	always_parse_args = strcmp(config_get(config, arg_names[0], "false"), "true") == 0;
 	show_all = strcmp(config_get(config, arg_names[1], "true"), "true") == 0;
 	print_command = strcmp(config_get(config, arg_names[2], "false"), "true") == 0;
+	path_cache_stats = strcmp(config_get(config, arg_names[3], "false"), "true") == 0;
+}
+
+void wofi_run_exec_init(struct mode* this, struct map* config) {
+	read_args(this, config);
+}
+
+void wofi_run_init(struct mode* this, struct map* config) {
+	read_args(this, config);
 
 	wl_list_init(&widgets);
+	wl_list_init(&listings);
 
 	struct map* cached = map_init();
 	struct wl_list* cache = wofi_read_cache(mode);
 
-	struct map* entries = map_init();
+	entries = map_init();
+	shown = map_init_void();
+	wl_list_init(&shown_entries);
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	watches = map_init();
 
 	struct cache_line* node, *tmp;
 	wl_list_for_each_safe(node, tmp, cache, link) {
@@ -74,11 +511,12 @@ void wofi_run_init(struct mode* this, struct map* config) {
 		stat(node->line, &info);
 		if(((access(node->line, X_OK) == 0 && S_ISREG(info.st_mode)) ||
 				strncmp(node->line, arg_str, strlen(arg_str)) == 0) && !map_contains(cached, full_path)) {
-			struct node* widget = malloc(sizeof(struct node));
+			struct node* widget = new_node();
 			widget->widget = wofi_create_widget(mode, &text, text, &node->line, 1);
 			wl_list_insert(&widgets, &widget->link);
 			map_put(cached, full_path, "true");
-			map_put(entries, text, "true");
+			mark_shown(full_path);
+			map_put(entries, text, full_path);
 		} else {
 			wofi_remove_cache(mode, node->line);
 		}
@@ -92,53 +530,102 @@ void wofi_run_init(struct mode* this, struct map* config) {
 	char* path = strdup(getenv("PATH"));
 
 	struct map* paths = map_init();
+	struct map* by_path = map_init_void();
+	load_listings(by_path);
+	size_t loaded = wl_list_length(&listings);
+	size_t hits = 0, misses = 0;
 
+	size_t job_count = 0, job_capacity = 0;
+	struct path_job* jobs = NULL;
 	char* save_ptr;
-	char* str = strtok_r(path, ":", &save_ptr);
-	do {
+	for(char* str = strtok_r(path, ":", &save_ptr); str != NULL; str = strtok_r(NULL, ":", &save_ptr)) {
+		if(job_count == job_capacity) {
+			job_capacity = job_capacity == 0 ? 16 : job_capacity * 2;
+			jobs = realloc(jobs, job_capacity * sizeof(struct path_job));
+		}
+		struct path_job* job = jobs + job_count++;
+		job->dir = str;
+		job->real_path = NULL;
+		job->dir_fd = -1;
+		job->cached = NULL;
+		job->listing = NULL;
+	}
+
+	scan_paths(jobs, job_count, by_path);
+	path_dirs = malloc(job_count * sizeof(char*));
 
-		str = realpath(str, NULL);
+	//The results are merged in PATH order so the first executable with a given name still wins when show_all is false
+	for(size_t idx = 0; idx < job_count; ++idx) {
+		struct path_job* job = jobs + idx;
+		char* str = job->real_path;
 		if(str == NULL) {
 			continue;
 		}
-		if(map_contains(paths, str)) {
+		if(map_contains(paths, str) || (job->cached == NULL && job->listing == NULL)) {
+			if(job->listing != NULL) {
+				free_listing(job->listing);
+			}
+			if(job->dir_fd != -1) {
+				close(job->dir_fd);
+			}
 			free(str);
 			continue;
 		}
 
 		map_put(paths, str, "true");
+		path_dirs[path_dir_count++] = strdup(str);
 
-		DIR* dir = opendir(str);
-		if(dir == NULL) {
-			continue;
+		struct path_listing* listing;
+		if(job->cached != NULL) {
+			++hits;
+			listing = job->cached;
+		} else {
+			++misses;
+			listing = job->listing;
+			wl_list_insert(listings.prev, &listing->link);
+		}
+		listing->used = true;
+
+		if(inotify_fd != -1) {
+			add_watch(str);
 		}
-		struct dirent* entry;
-		while((entry = readdir(dir)) != NULL) {
-			if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+		for(size_t count = 0; count < listing->count; ++count) {
+			char* text = listing->names[count];
+			if((!show_all && map_contains(entries, text)) || faccessat(job->dir_fd, text, X_OK, 0) != 0) {
 				continue;
 			}
-			char* full_path = utils_concat(3, str, "/", entry->d_name);
-			struct stat info;
-			stat(full_path, &info);
-			if(access(full_path, X_OK) == 0 && S_ISREG(info.st_mode) &&
-					!map_contains(cached, full_path) &&
-					(show_all || !map_contains(entries, entry->d_name))) {
-				char* text = strdup(entry->d_name);
-				map_put(entries, text, "true");
-				struct node* widget = malloc(sizeof(struct node));
+			char* full_path = utils_concat(3, str, "/", text);
+			if(!map_contains(cached, full_path)) {
+				mark_shown(full_path);
+				map_put(entries, text, full_path);
+				struct node* widget = new_node();
 				widget->widget = wofi_create_widget(mode, &text, text, &full_path, 1);
 				wl_list_insert(&widgets, &widget->link);
-				free(text);
 			}
 			free(full_path);
 		}
+		close(job->dir_fd);
 		free(str);
-		closedir(dir);
-	} while((str = strtok_r(NULL, ":", &save_ptr)) != NULL);
+	}
+	free(jobs);
+
+	//Rewrite the cache if anything was listed or a directory left PATH
+	if(misses > 0 || hits != loaded) {
+		write_listings();
+	}
+	if(path_cache_stats) {
+		fprintf(stderr, "run: PATH cache %zu hits, %zu misses\n", hits, misses);
+	}
+	free_listings();
+
 	free(path);
 	map_free(paths);
+	map_free(by_path);
 	map_free(cached);
-	map_free(entries);
+
+	if(inotify_fd != -1) {
+		g_unix_fd_add(inotify_fd, G_IO_IN, handle_watch, NULL);
+	}
 }
 
 struct widget* wofi_run_get_widget(void) {
@@ -146,9 +633,9 @@ struct widget* wofi_run_get_widget(void) {
 	wl_list_for_each_reverse_safe(node, tmp, &widgets, link) {
 		struct widget* widget = node->widget;
 		wl_list_remove(&node->link);
-		free(node);
 		return widget;
 	}
+	free_nodes();
 	return NULL;
 }
 
@@ -0,0 +1,675 @@
+/*
+ *  Copyright (C) 2019-2024 Scoopta
+ *  This file is part of Wofi
+ *  Wofi is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Wofi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Wofi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cache.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <map.h>
+#include <utils.h>
+#include <wofi_api.h>
+
+#include <glib.h>
+
+#define LOG_MAGIC "WOFICLOG"
+#define LOG_VERSION 2
+#define LOG_ADD 1
+#define LOG_REMOVE 2
+//How many more records than entries the log can hold before it's compacted
+#define COMPACT_SLACK 256
+//How long it takes for a launch to count half as much
+#define HALF_LIFE (14 * 24 * 60 * 60)
+
+struct log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t padding;
+};
+
+//Followed by the NUL terminated command padded up to a multiple of 8 bytes
+//Version 1 records stop after count
+struct log_record {
+	uint32_t op;
+	uint32_t length;
+	uint64_t count;
+	int64_t time;
+	double score;
+};
+
+#define LOG_RECORD_V1_SIZE 16
+
+struct buffer {
+	char* data;
+	size_t size, capacity;
+};
+
+//score is the decayed launch count as of time, rank is the same thing as of when the cache was read
+struct cache_entry {
+	char* cmd;
+	uint64_t count;
+	int64_t time;
+	double score, rank;
+	size_t position;
+	struct wl_list link;
+};
+
+//Everything replayed from one cache log, changes are appended to it when committed
+struct cache_session {
+	char* path;
+	struct wl_list entries;
+	GHashTable* index;
+	size_t position, live_count, record_count;
+	struct buffer pending;
+	//Records a detached child is writing, they only count as written once it reports back on detached_fd
+	struct buffer detached;
+	int detached_fd;
+	bool compacting;
+	struct wl_list link;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct map* sessions = NULL;
+static struct wl_list session_list;
+static int compact_lock_fd = -1;
+
+static char* escape_lf(const char* cmd) {
+	size_t len = strlen(cmd);
+	char* buffer = calloc(1, (len + 1) * 2);
+
+	size_t buf_count = 0;
+	for(size_t count = 0; count < len; ++count) {
+		char chr = cmd[count];
+		if(chr == '\n') {
+			buffer[buf_count++] = '\\';
+			buffer[buf_count++] = 'n';
+		} else if(chr == '\\') {
+			buffer[buf_count++] = '\\';
+			buffer[buf_count++] = '\\';
+		} else {
+			buffer[buf_count++] = chr;
+		}
+	}
+	return buffer;
+}
+
+static char* remove_escapes(const char* cmd) {
+	size_t len = strlen(cmd);
+	char* buffer = calloc(1, len + 1);
+
+	size_t buf_count = 0;
+	for(size_t count = 0; count < len; ++count) {
+		char chr = cmd[count];
+		if(chr == '\\') {
+			chr = cmd[++count];
+			if(chr == 'n') {
+				buffer[buf_count++] = '\n';
+			} else if(chr == '\\') {
+				buffer[buf_count++] = '\\';
+			}
+		} else {
+			buffer[buf_count++] = chr;
+		}
+	}
+	return buffer;
+}
+
+static void buffer_append(struct buffer* buffer, const void* data, size_t size) {
+	if(buffer->size + size > buffer->capacity) {
+		buffer->capacity = (buffer->size + size) * 2;
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void append_record(struct buffer* buffer, uint32_t op, const char* cmd, uint64_t count, int64_t time, double score) {
+	static const char zeros[8] = {0};
+	size_t length = strlen(cmd);
+	size_t padded = (length + 8) & ~(size_t) 7;
+	struct log_record record = {
+		.op = op,
+		.length = length,
+		.count = count,
+		.time = time,
+		.score = score
+	};
+	buffer_append(buffer, &record, sizeof(record));
+	buffer_append(buffer, cmd, length);
+	buffer_append(buffer, zeros, padded - length);
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+	while(size > 0) {
+		ssize_t len = write(fd, data, size);
+		if(len == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += len;
+		size -= len;
+	}
+	return true;
+}
+
+static double decay(double score, int64_t from, int64_t to) {
+	if(to <= from) {
+		return score;
+	}
+	return score * exp2(-(double) (to - from) / HALF_LIFE);
+}
+
+static void add_entry(struct cache_session* session, const char* cmd, uint64_t count, int64_t time, double score) {
+	struct cache_entry* entry = g_hash_table_lookup(session->index, cmd);
+	if(entry != NULL) {
+		//Records from other instances can be older than what's already been replayed
+		if(time >= entry->time) {
+			entry->score = decay(entry->score, entry->time, time) + score;
+			entry->time = time;
+		} else {
+			entry->score += decay(score, time, entry->time);
+		}
+		entry->count += count;
+		return;
+	}
+	entry = malloc(sizeof(struct cache_entry));
+	entry->cmd = strdup(cmd);
+	entry->count = count;
+	entry->time = time;
+	entry->score = score;
+	entry->position = session->position++;
+	wl_list_insert(session->entries.prev, &entry->link);
+	g_hash_table_insert(session->index, entry->cmd, entry);
+	++session->live_count;
+}
+
+static bool remove_entry(struct cache_session* session, const char* cmd) {
+	struct cache_entry* entry = g_hash_table_lookup(session->index, cmd);
+	if(entry == NULL) {
+		return false;
+	}
+	g_hash_table_remove(session->index, cmd);
+	wl_list_remove(&entry->link);
+	free(entry->cmd);
+	free(entry);
+	--session->live_count;
+	return true;
+}
+
+static void append_header(struct buffer* buffer) {
+	struct log_header header = {0};
+	memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+	header.version = LOG_VERSION;
+	buffer_append(buffer, &header, sizeof(header));
+}
+
+static void build_snapshot(struct cache_session* session, struct buffer* buffer) {
+	append_header(buffer);
+
+	struct cache_entry* entry;
+	wl_list_for_each(entry, &session->entries, link) {
+		append_record(buffer, LOG_ADD, entry->cmd, entry->count, entry->time, entry->score);
+	}
+}
+
+//Returns the version of the log or 0 if it isn't one
+static uint32_t replay_log(struct cache_session* session, char* data, size_t size) {
+	struct log_header header;
+	if(size < sizeof(header)) {
+		return 0;
+	}
+	memcpy(&header, data, sizeof(header));
+	if(memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0 || header.version == 0 || header.version > LOG_VERSION) {
+		return 0;
+	}
+
+	//Version 1 logs have no timestamps, everything in them is treated as if it had just been used
+	int64_t now = time(NULL);
+	size_t record_size = header.version == 1 ? LOG_RECORD_V1_SIZE : sizeof(struct log_record);
+
+	//A record cut short by a crash is the end of the log
+	size_t offset = sizeof(header);
+	while(size - offset >= record_size) {
+		struct log_record record = {
+			.time = now
+		};
+		memcpy(&record, data + offset, record_size);
+		if(header.version == 1) {
+			record.score = record.count;
+		}
+		size_t padded = ((size_t) record.length + 8) & ~(size_t) 7;
+		if(size - offset - record_size < padded) {
+			break;
+		}
+		char* cmd = data + offset + record_size;
+		if(cmd[record.length] != 0) {
+			break;
+		}
+		if(record.op == LOG_ADD) {
+			add_entry(session, cmd, record.count, record.time, record.score);
+		} else if(record.op == LOG_REMOVE) {
+			remove_entry(session, cmd);
+		}
+		++session->record_count;
+		offset += record_size + padded;
+	}
+	return header.version;
+}
+
+static void replay_legacy(struct cache_session* session, char* data) {
+	int64_t now = time(NULL);
+	char* save_ptr;
+	for(char* line = strtok_r(data, "\n", &save_ptr); line != NULL; line = strtok_r(NULL, "\n", &save_ptr)) {
+		char* space = strchr(line, ' ');
+		if(space != NULL) {
+			uint64_t count = strtoull(line, NULL, 10);
+			add_entry(session, space + 1, count, now, count);
+		}
+	}
+}
+
+//Everything that touches the log file itself holds this, it's a separate file since the log gets replaced when compacted
+static int lock_log(const char* path) {
+	char* lock_path = utils_concat(2, path, ".lock");
+	int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	free(lock_path);
+	if(fd != -1) {
+		while(flock(fd, LOCK_EX) == -1 && errno == EINTR);
+	}
+	return fd;
+}
+
+static void unlock_log(int fd) {
+	if(fd != -1) {
+		close(fd);
+	}
+}
+
+static char* read_file(const char* path, size_t* size) {
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		return NULL;
+	}
+	struct stat info;
+	char* data = NULL;
+	if(fstat(fileno(file), &info) == 0) {
+		data = malloc(info.st_size + 1);
+		*size = fread(data, 1, info.st_size, file);
+		data[*size] = 0;
+	}
+	fclose(file);
+	return data;
+}
+
+//Only called with the log locked so the temporary file can't be written by two instances at once
+static bool write_file(const char* path, struct buffer* buffer) {
+	char* tmp_path = utils_concat(2, path, ".compact");
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	bool ok = fd != -1 && write_all(fd, buffer->data, buffer->size);
+	if(fd != -1) {
+		ok = close(fd) == 0 && ok;
+	}
+	if(fd != -1 && (!ok || rename(tmp_path, path) == -1)) {
+		unlink(tmp_path);
+		ok = false;
+	}
+	free(tmp_path);
+	return ok;
+}
+
+static void init_session(struct cache_session* session, const char* path) {
+	session->path = strdup(path);
+	session->index = g_hash_table_new(g_str_hash, g_str_equal);
+	session->detached_fd = -1;
+	wl_list_init(&session->entries);
+}
+
+static void free_entries(struct cache_session* session) {
+	struct cache_entry* entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &session->entries, link) {
+		g_hash_table_remove(session->index, entry->cmd);
+		free(entry->cmd);
+		free(entry);
+	}
+	wl_list_init(&session->entries);
+	session->position = 0;
+	session->live_count = 0;
+	session->record_count = 0;
+}
+
+static void free_session(struct cache_session* session) {
+	free_entries(session);
+	g_hash_table_destroy(session->index);
+	free(session->path);
+	free(session->pending.data);
+	free(session->detached.data);
+	if(session->detached_fd != -1) {
+		close(session->detached_fd);
+	}
+}
+
+static void* compact(void* data) {
+	struct cache_session* session = data;
+	//The fd is opened and recorded under the mutex so a detached commit never forks with a copy it doesn't know to close
+	//Commits take the mutex before locking the log so the flock itself has to wait until the mutex is released
+	char* lock_path = utils_concat(2, session->path, ".lock");
+	pthread_mutex_lock(&lock);
+	int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	compact_lock_fd = lock_fd;
+	pthread_mutex_unlock(&lock);
+	free(lock_path);
+	if(lock_fd != -1) {
+		while(flock(lock_fd, LOCK_EX) == -1 && errno == EINTR);
+	}
+
+	//Other instances may have appended since this one read the log so the snapshot is taken from what's on disk
+	bool ok = false;
+	size_t size, records = 0;
+	char* contents = read_file(session->path, &size);
+	if(contents != NULL) {
+		struct cache_session merged = {0};
+		init_session(&merged, session->path);
+		if(replay_log(&merged, contents, size) != 0) {
+			struct buffer snapshot = {0};
+			build_snapshot(&merged, &snapshot);
+			ok = write_file(session->path, &snapshot);
+			records = merged.live_count;
+			free(snapshot.data);
+		}
+		free_session(&merged);
+		free(contents);
+	}
+
+	if(lock_fd != -1) {
+		flock(lock_fd, LOCK_UN);
+	}
+	pthread_mutex_lock(&lock);
+	unlock_log(lock_fd);
+	compact_lock_fd = -1;
+	if(ok) {
+		session->record_count = records;
+	}
+	session->compacting = false;
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static void maybe_compact(struct cache_session* session) {
+	if(session->compacting || session->record_count <= session->live_count + COMPACT_SLACK) {
+		return;
+	}
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, compact, session) == 0) {
+		session->compacting = true;
+		pthread_detach(thread);
+	}
+}
+
+static struct cache_session* get_session(const char* path) {
+	if(sessions == NULL) {
+		sessions = map_init_void();
+		wl_list_init(&session_list);
+	}
+	struct cache_session* session = map_get(sessions, path);
+	if(session != NULL) {
+		return session;
+	}
+
+	session = calloc(1, sizeof(struct cache_session));
+	init_session(session, path);
+	wl_list_insert(session_list.prev, &session->link);
+	map_put_void(sessions, path, session);
+
+	size_t size;
+	char* data = read_file(path, &size);
+	if(data != NULL && replay_log(session, data, size) != LOG_VERSION) {
+		//Caches from before the log format are plain "count cmd" lines, they and older logs are converted the first time they're read
+		free(data);
+		free_entries(session);
+		int lock_fd = lock_log(path);
+		data = read_file(path, &size);
+		uint32_t version = data == NULL ? LOG_VERSION : replay_log(session, data, size);
+		if(version != LOG_VERSION) {
+			if(version == 0) {
+				replay_legacy(session, data);
+			}
+			struct buffer snapshot = {0};
+			build_snapshot(session, &snapshot);
+			if(write_file(path, &snapshot)) {
+				session->record_count = session->live_count;
+			}
+			free(snapshot.data);
+		}
+		unlock_log(lock_fd);
+	}
+	free(data);
+
+	maybe_compact(session);
+	return session;
+}
+
+static int compare_entries(const void* p1, const void* p2) {
+	const struct cache_entry* entry1 = *(struct cache_entry**) p1;
+	const struct cache_entry* entry2 = *(struct cache_entry**) p2;
+	if(entry1->rank != entry2->rank) {
+		return entry1->rank < entry2->rank ? 1 : -1;
+	}
+	return entry1->position < entry2->position ? -1 : entry1->position > entry2->position;
+}
+
+//Highest frecency first, the scores are decayed to the current time once here rather than in the comparison
+struct wl_list* cache_read(const char* path) {
+	struct wl_list* cache = malloc(sizeof(struct wl_list));
+	wl_list_init(cache);
+
+	pthread_mutex_lock(&lock);
+	struct cache_session* session = get_session(path);
+	size_t count = 0;
+	struct cache_entry** sorted = malloc(wl_list_length(&session->entries) * sizeof(struct cache_entry*));
+	int64_t now = time(NULL);
+	struct cache_entry* entry;
+	wl_list_for_each(entry, &session->entries, link) {
+		entry->rank = decay(entry->score, entry->time, now);
+		sorted[count++] = entry;
+	}
+	qsort(sorted, count, sizeof(struct cache_entry*), compare_entries);
+
+	for(size_t idx = 0; idx < count; ++idx) {
+		struct cache_line* node = malloc(sizeof(struct cache_line));
+		node->line = remove_escapes(sorted[idx]->cmd);
+		wl_list_insert(cache->prev, &node->link);
+	}
+	pthread_mutex_unlock(&lock);
+
+	free(sorted);
+	return cache;
+}
+
+void cache_increment(const char* path, const char* _cmd) {
+	char* cmd = escape_lf(_cmd);
+	pthread_mutex_lock(&lock);
+	struct cache_session* session = get_session(path);
+	int64_t now = time(NULL);
+	add_entry(session, cmd, 1, now, 1);
+	append_record(&session->pending, LOG_ADD, cmd, 1, now, 1);
+	pthread_mutex_unlock(&lock);
+	free(cmd);
+}
+
+void cache_remove(const char* path, const char* _cmd) {
+	char* cmd = escape_lf(_cmd);
+	pthread_mutex_lock(&lock);
+	struct cache_session* session = get_session(path);
+	if(remove_entry(session, cmd)) {
+		append_record(&session->pending, LOG_REMOVE, cmd, 0, 0, 0);
+	}
+	pthread_mutex_unlock(&lock);
+	free(cmd);
+}
+
+//Appends everything that changed since the last commit in a single write
+static bool write_pending(struct cache_session* session) {
+	char* dir = strdup(session->path);
+	utils_mkdir(dirname(dir), S_IRWXU | S_IRGRP | S_IXGRP);
+	free(dir);
+
+	//The log is only opened once locked, otherwise the append could go to a log that was just compacted away
+	int lock_fd = lock_log(session->path);
+	int fd = open(session->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	if(fd == -1) {
+		unlock_log(lock_fd);
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) == 0 && info.st_size == 0) {
+		struct buffer header = {0};
+		append_header(&header);
+		write_all(fd, header.data, header.size);
+		free(header.data);
+	}
+	bool ok = write_all(fd, session->pending.data, session->pending.size);
+	close(fd);
+	unlock_log(lock_fd);
+	return ok;
+}
+
+static void mark_written(struct cache_session* session, struct buffer* buffer) {
+	size_t records = 0;
+	for(size_t offset = 0; offset < buffer->size; ++records) {
+		struct log_record* record = (struct log_record*) (buffer->data + offset);
+		offset += sizeof(struct log_record) + (((size_t) record->length + 8) & ~(size_t) 7);
+	}
+	session->record_count += records;
+	buffer->size = 0;
+}
+
+//Waits for the detached child to report, if it couldn't write its records they're put back in front of the pending ones
+static void settle_detached(struct cache_session* session) {
+	if(session->detached_fd == -1) {
+		return;
+	}
+	char written = 0;
+	ssize_t len;
+	do {
+		len = read(session->detached_fd, &written, 1);
+	} while(len == -1 && errno == EINTR);
+	close(session->detached_fd);
+	session->detached_fd = -1;
+
+	if(len == 1 && written) {
+		mark_written(session, &session->detached);
+		return;
+	}
+	buffer_append(&session->detached, session->pending.data, session->pending.size);
+	struct buffer pending = session->pending;
+	session->pending = session->detached;
+	session->detached = pending;
+	session->detached.size = 0;
+}
+
+static void commit(struct cache_session* session) {
+	settle_detached(session);
+	if(session->pending.size == 0) {
+		return;
+	}
+	if(write_pending(session)) {
+		mark_written(session, &session->pending);
+	}
+	session->pending.size = 0;
+	maybe_compact(session);
+}
+
+//The write is done by a grandchild so whatever was selected doesn't wait on a slow cache dir
+void cache_commit_detached(const char* path) {
+	pthread_mutex_lock(&lock);
+	struct cache_session* session = sessions == NULL ? NULL : map_get(sessions, path);
+	if(session == NULL || session->pending.size == 0) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	//An earlier detached write has to be settled first so the records reach the log in order
+	settle_detached(session);
+
+	int status_fds[2];
+	if(pipe2(status_fds, O_CLOEXEC) == -1) {
+		commit(session);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		if(fork() == 0) {
+			close(status_fds[0]);
+			//The compaction thread doesn't exist in here, its copy of the lock would never be released
+			if(compact_lock_fd != -1) {
+				close(compact_lock_fd);
+			}
+			//Holding on to stdout would keep anything reading wofi's output waiting for EOF
+			int null_fd = open("/dev/null", O_RDWR);
+			dup2(null_fd, STDIN_FILENO);
+			dup2(null_fd, STDOUT_FILENO);
+			dup2(null_fd, STDERR_FILENO);
+			//Nobody is left to read the status if wofi exec'd whatever was selected
+			signal(SIGPIPE, SIG_IGN);
+			char written = write_pending(session);
+			write_all(status_fds[1], &written, 1);
+		}
+		_exit(0);
+	} else if(pid > 0) {
+		close(status_fds[1]);
+		waitpid(pid, NULL, 0);
+		//They're only set aside, the next commit waits for the child and writes them itself if the child couldn't
+		struct buffer detached = session->detached;
+		session->detached = session->pending;
+		session->pending = detached;
+		session->detached_fd = status_fds[0];
+	} else {
+		close(status_fds[0]);
+		close(status_fds[1]);
+		commit(session);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void cache_commit_all(void) {
+	pthread_mutex_lock(&lock);
+	if(sessions != NULL) {
+		struct cache_session* session;
+		wl_list_for_each(session, &session_list, link) {
+			commit(session);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
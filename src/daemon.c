@@ -0,0 +1,243 @@
+/*
+ *  Copyright (C) 2019-2024 Scoopta
+ *  This file is part of Wofi
+ *  Wofi is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Wofi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Wofi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <daemon.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include <wofi.h>
+#include <utils.h>
+
+#include <glib-unix.h>
+
+static bool is_daemon = false;
+static int client = -1;
+static guint client_source = 0;
+
+static char* get_socket_path(const char* mode) {
+	char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if(runtime_dir == NULL) {
+		return NULL;
+	}
+	return utils_concat(4, runtime_dir, "/wofi-", mode, ".sock");
+}
+
+static bool get_socket_addr(const char* path, struct sockaddr_un* addr) {
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path)) {
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static int connect_socket(const char* path) {
+	struct sockaddr_un addr;
+	if(!get_socket_addr(path, &addr)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1) {
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void write_all(int fd, const char* buf, size_t len) {
+	while(len > 0) {
+		ssize_t written = send(fd, buf, len, MSG_NOSIGNAL);
+		if(written == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		buf += written;
+		len -= written;
+	}
+}
+
+static void close_client(void) {
+	if(client_source != 0) {
+		g_source_remove(client_source);
+		client_source = 0;
+	}
+	close(client);
+	client = -1;
+}
+
+static gboolean client_gone(gint fd, GIOCondition condition, gpointer data) {
+	(void) condition;
+	(void) data;
+	char buf[64];
+	ssize_t size = read(fd, buf, sizeof(buf));
+	if(size > 0 || (size == -1 && errno == EINTR)) {
+		return G_SOURCE_CONTINUE;
+	}
+
+	//The client was killed before anything was selected, there's nobody left to show the menu for
+	client_source = 0;
+	close_client();
+	wofi_hide();
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean accept_client(gint fd, GIOCondition condition, gpointer data) {
+	(void) condition;
+	(void) data;
+	int new_client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if(new_client == -1) {
+		return G_SOURCE_CONTINUE;
+	}
+
+	//Invoking wofi while it's already open closes it, the same as pressing escape
+	if(client != -1) {
+		close(new_client);
+		wofi_daemon_reply_exit(1);
+		wofi_hide();
+		return G_SOURCE_CONTINUE;
+	}
+
+	client = new_client;
+	client_source = g_unix_fd_add(client, G_IO_IN | G_IO_HUP | G_IO_ERR, client_gone, NULL);
+	wofi_show();
+	return G_SOURCE_CONTINUE;
+}
+
+void wofi_daemon_listen(const char* mode) {
+	char* path = get_socket_path(mode);
+	if(path == NULL) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set, cannot run as a daemon\n");
+		exit(1);
+	}
+
+	int fd = connect_socket(path);
+	if(fd != -1) {
+		fprintf(stderr, "A wofi daemon is already running for %s\n", mode);
+		exit(1);
+	}
+
+	//Nobody is listening so anything left at the path is from a daemon that didn't exit cleanly
+	unlink(path);
+
+	struct sockaddr_un addr;
+	if(!get_socket_addr(path, &addr)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		exit(1);
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(fd, 4) == -1) {
+		fprintf(stderr, "Could not listen on %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	free(path);
+
+	g_unix_fd_add(fd, G_IO_IN, accept_client, NULL);
+	is_daemon = true;
+}
+
+int wofi_daemon_connect(const char* mode) {
+	char* path = get_socket_path(mode);
+	if(path == NULL) {
+		return -1;
+	}
+	int fd = connect_socket(path);
+	free(path);
+	return fd;
+}
+
+void wofi_daemon_client(int fd) {
+	//Connecting is enough to show the menu, the reply only arrives once the user is done with it
+	size_t size = 256, len = 0;
+	char* reply = malloc(size);
+	ssize_t count;
+	while((count = read(fd, reply + len, size - len - 1)) != 0) {
+		if(count == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		len += count;
+		if(size - len == 1) {
+			size *= 2;
+			reply = realloc(reply, size);
+		}
+	}
+	close(fd);
+	reply[len] = 0;
+
+	if(strncmp(reply, "exec ", 5) == 0) {
+		char* ptr = reply + 5;
+		int code = strtol(ptr, &ptr, 10);
+		bool shift = strtol(ptr, &ptr, 10);
+		bool ctrl = strtol(ptr, &ptr, 10);
+		char* mode = ptr + 1;
+		char* lf = strchr(mode, '\n');
+		if(lf != NULL) {
+			*lf = 0;
+			wofi_exec(mode, lf + 1, shift, ctrl, code);
+		}
+	} else if(strncmp(reply, "exit ", 5) == 0) {
+		wofi_exit(strtol(reply + 5, NULL, 10));
+	}
+	fprintf(stderr, "Lost the connection to the wofi daemon\n");
+	wofi_exit(1);
+}
+
+bool wofi_daemon_has_client(void) {
+	return client != -1;
+}
+
+bool wofi_daemon_is_running(void) {
+	return is_daemon;
+}
+
+void wofi_daemon_reply_exec(const char* mode, const char* cmd, bool shift, bool ctrl, int code) {
+	if(client == -1) {
+		return;
+	}
+	char header[32];
+	snprintf(header, sizeof(header), "exec %d %d %d ", code, shift, ctrl);
+	write_all(client, header, strlen(header));
+	write_all(client, mode, strlen(mode));
+	write_all(client, "\n", 1);
+	write_all(client, cmd, strlen(cmd));
+	close_client();
+}
+
+void wofi_daemon_reply_exit(int status) {
+	if(client == -1) {
+		return;
+	}
+	char reply[32];
+	snprintf(reply, sizeof(reply), "exit %d\n", status);
+	write_all(client, reply, strlen(reply));
+	close_client();
+}
@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <getopt.h>
 #include <string.h>
+#include <locale.h>
 #include <unistd.h>
 #include <signal.h>
 
@@ -28,6 +29,7 @@
 #include <wofi.h>
 #include <utils.h>
 #include <config.h>
+#include <daemon.h>
 
 #include <wayland-client.h>
 
@@ -100,6 +102,7 @@ static void print_usage(char** argv) {
 	printf(PRINT_USAGE_FORMAT,   "-r",   ',',   "--pre-display-cmd",     "\t",       "Runs command for the displayed entries, without changing the output. %%s for the real string");
 	printf(PRINT_USAGE_FORMAT,   "  ",   ' ',   "--render-only-image",   "\t",       "Remove label of dmenu image");
 	printf(PRINT_USAGE_FORMAT,   "  ",   ' ',   "--bottom-search",       "\t",       "Move input entry under scroll");
+	printf(PRINT_USAGE_FORMAT,   "  ",   ' ',   "--daemon",              "\t\t\t",   "Stays running in the background so later invocations show instantly");
 	exit(0);
 }
 
@@ -232,8 +235,9 @@ int main(int argc, char** argv) {
 	typedef enum
 	{
 		OPT_NONE = 0,
-		OPT_RENDER_ONLY_IMAGE,
-		OPT_BOTTOM_SEARCH
+		OPT_RENDER_ONLY_IMAGE = 2,
+		OPT_BOTTOM_SEARCH,
+		OPT_DAEMON
 	} OptIndex;
 
 	const struct option opts[] =
@@ -243,6 +247,7 @@ int main(int argc, char** argv) {
 		/* Long options only comes first */
 		{ .name = "render-only-image",   .has_arg = no_argument,         .flag = NULL,   .val = '0' },
 		{ .name = "bottom-search",       .has_arg = no_argument,         .flag = NULL,   .val = '0' },
+		{ .name = "daemon",              .has_arg = no_argument,         .flag = NULL,   .val = '0' },
 		/* Double options */
 		{ .name = "help",                .has_arg = no_argument,         .flag = NULL,   .val = 'h' },
 		{ .name = "fork",                .has_arg = no_argument,         .flag = NULL,   .val = 'f' },
@@ -284,6 +289,7 @@ int main(int argc, char** argv) {
 	const char* config_str = NULL;
 	      char* dmenu_only_image = NULL;
 	      char* bottom_search = NULL;
+	      char* daemon = NULL;
 	      char* style_str = NULL;
 	      char* color_str = NULL;
 	      char* mode = NULL;
@@ -330,6 +336,7 @@ int main(int argc, char** argv) {
 					case OPT_NONE: fprintf(stderr, "ERROR: No valid option has been provided.\nMore information: -h.\n"); exit(1);
 					case OPT_RENDER_ONLY_IMAGE: dmenu_only_image = "true"; break;
 					case OPT_BOTTOM_SEARCH: bottom_search = "true"; break;
+					case OPT_DAEMON: daemon = "true"; break;
 					default: exit(1);
 				}
 			} break;
@@ -580,6 +587,27 @@ int main(int argc, char** argv) {
 	sigact.sa_handler = sig;
 	sigaction(SIGTERM, &sigact, NULL);
 
+	//gtk_init would do this once the mode thread is already running, setlocale isn't safe to call while other threads use the locale
+	setlocale(LC_ALL, "");
+
+	char* mode_str = map_get(config, "mode");
+	if(daemon != NULL) {
+		if(strstr(mode_str, "dmenu") != NULL) {
+			fprintf(stderr, "dmenu reads its entries from stdin and cannot be run as a daemon\n");
+			exit(1);
+		}
+		wofi_daemon_listen(mode_str);
+	} else {
+		int fd = wofi_daemon_connect(mode_str);
+		if(fd != -1) {
+			//A daemon is already showing the menu, the selection's mode is loaded once it arrives so it can be executed here
+			wofi_start_client(config);
+			wofi_daemon_client(fd);
+		}
+	}
+
+	//Modes only need the config so they can start scanning while GTK and the compositor are being set up
+	wofi_start_modes(config);
 
 	gtk_init(&argc, &argv);
 
@@ -18,49 +18,187 @@
 #include <map.h>
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <gmodule.h>
+#define INITIAL_CAPACITY 8
+#define INITIAL_BLOCK 128
+#define MAX_BLOCK 65536
+
+//dist is how far the slot is from where its hash wants it plus one, 0 means the slot is empty
+struct slot {
+	uint32_t hash;
+	uint32_t dist;
+	const char* key;
+	void* value;
+};
+
+//Keys are never removed so they're packed into blocks which are only freed with the map
+struct key_block {
+	struct key_block* next;
+	size_t size, used;
+	char data[];
+};
 
 struct map {
-	GTree* tree;
-	bool mman;
+	struct slot* slots;
+	size_t capacity, size;
+	struct key_block* keys;
+	bool mman, borrowed;
 };
 
-static gint compare(gconstpointer p1, gconstpointer p2, gpointer data) {
-	(void) data;
-	const char* str1 = p1;
-	const char* str2 = p2;
-	return strcmp(str1, str2);
+static uint32_t hash_key(const char* key) {
+	uint64_t hash = 14695981039346656037ULL;
+	for(const unsigned char* chr = (const unsigned char*) key; *chr != 0; ++chr) {
+		hash ^= *chr;
+		hash *= 1099511628211ULL;
+	}
+	return hash ^ (hash >> 32);
 }
 
-struct map* map_init(void) {
+static struct map* init(bool mman, bool borrowed) {
 	struct map* map = malloc(sizeof(struct map));
-	map->tree = g_tree_new_full(compare, NULL, free, free);
-	map->mman = true;
+	map->slots = calloc(INITIAL_CAPACITY, sizeof(struct slot));
+	map->capacity = INITIAL_CAPACITY;
+	map->size = 0;
+	map->keys = NULL;
+	map->mman = mman;
+	map->borrowed = borrowed;
 	return map;
 }
 
+struct map* map_init(void) {
+	return init(true, false);
+}
+
 struct map* map_init_void(void) {
-	struct map* map = malloc(sizeof(struct map));
-	map->tree = g_tree_new_full(compare, NULL, free, NULL);
-	map->mman = false;
-	return map;
+	return init(false, false);
+}
+
+struct map* map_init_borrowed(void) {
+	return init(false, true);
 }
 
 void map_free(struct map* map) {
-	g_tree_destroy(map->tree);
+	if(map->mman) {
+		for(size_t count = 0; count < map->capacity; ++count) {
+			if(map->slots[count].dist != 0) {
+				free(map->slots[count].value);
+			}
+		}
+	}
+	struct key_block* block = map->keys;
+	while(block != NULL) {
+		struct key_block* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(map->slots);
 	free(map);
 }
 
+static const char* copy_key(struct map* map, const char* key) {
+	if(map->borrowed) {
+		return key;
+	}
+	size_t len = strlen(key) + 1;
+	struct key_block* block = map->keys;
+	if(block == NULL || block->size - block->used < len) {
+		size_t size = block == NULL ? INITIAL_BLOCK : block->size * 2;
+		if(size > MAX_BLOCK) {
+			size = MAX_BLOCK;
+		}
+		if(size < len) {
+			size = len;
+		}
+		block = malloc(sizeof(struct key_block) + size);
+		block->next = map->keys;
+		block->size = size;
+		block->used = 0;
+		map->keys = block;
+	}
+	char* copy = block->data + block->used;
+	memcpy(copy, key, len);
+	block->used += len;
+	return copy;
+}
+
+static struct slot* find(struct map* map, uint32_t hash, const char* key) {
+	size_t mask = map->capacity - 1;
+	size_t idx = hash & mask;
+	for(uint32_t dist = 1;; ++dist) {
+		struct slot* slot = map->slots + idx;
+		//Anything this far from home would have displaced whatever is here
+		if(slot->dist < dist) {
+			return NULL;
+		}
+		if(slot->hash == hash && strcmp(slot->key, key) == 0) {
+			return slot;
+		}
+		idx = (idx + 1) & mask;
+	}
+}
+
+//Slots closer to where they want to be give way to ones further away so probe lengths stay short
+static void insert(struct map* map, struct slot slot) {
+	size_t mask = map->capacity - 1;
+	slot.dist = 1;
+	for(size_t idx = slot.hash & mask;; idx = (idx + 1) & mask) {
+		struct slot* current = map->slots + idx;
+		if(current->dist == 0) {
+			*current = slot;
+			return;
+		}
+		if(current->dist < slot.dist) {
+			struct slot tmp = *current;
+			*current = slot;
+			slot = tmp;
+		}
+		++slot.dist;
+	}
+}
+
+static void grow(struct map* map) {
+	struct slot* old = map->slots;
+	size_t old_capacity = map->capacity;
+	map->capacity *= 2;
+	map->slots = calloc(map->capacity, sizeof(struct slot));
+	for(size_t count = 0; count < old_capacity; ++count) {
+		if(old[count].dist != 0) {
+			insert(map, old[count]);
+		}
+	}
+	free(old);
+}
+
 static void put(struct map* map, const char* key, void* value) {
-	char* k = strdup(key);
 	char* v = value;
 	if(map->mman && value != NULL) {
 		v = strdup(value);
 	}
-	g_tree_insert(map->tree, k, v);
+
+	uint32_t hash = hash_key(key);
+	struct slot* slot = find(map, hash, key);
+	if(slot != NULL) {
+		if(map->mman) {
+			free(slot->value);
+		}
+		slot->value = v;
+		return;
+	}
+
+	//Kept at most 7/8 full
+	if((map->size + 1) * 8 > map->capacity * 7) {
+		grow(map);
+	}
+	struct slot new_slot = {
+		.hash = hash,
+		.key = copy_key(map, key),
+		.value = v
+	};
+	insert(map, new_slot);
+	++map->size;
 }
 
 bool map_put(struct map* map, const char* key, char* value) {
@@ -84,7 +222,8 @@ bool map_put_void(struct map* map, const char* key, void* value) {
 }
 
 void* map_get(struct map* map, const char* key) {
-	return g_tree_lookup(map->tree, key);
+	struct slot* slot = find(map, hash_key(key), key);
+	return slot == NULL ? NULL : slot->value;
 }
 
 bool map_contains(struct map* map, const char* key) {
@@ -92,5 +231,5 @@ bool map_contains(struct map* map, const char* key) {
 }
 
 size_t map_size(struct map* map) {
-	return g_tree_nnodes(map->tree);
+	return map->size;
 }
@@ -17,26 +17,40 @@
 
 #include <property_box.h>
 
-#include <map.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The key and value share one allocation starting at key
+struct property {
+	char* key;
+	char* value;
+};
 
 struct _WofiPropertyBox {
 	GtkBox super;
 };
 
+//Boxes only ever hold a handful of properties so they're kept in an array
 typedef struct {
-	struct map* properties;
+	struct property* properties;
+	size_t count, capacity;
 } WofiPropertyBoxPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE(WofiPropertyBox, wofi_property_box, GTK_TYPE_BOX)
 
 static void wofi_property_box_init(WofiPropertyBox* box) {
 	WofiPropertyBoxPrivate* this = wofi_property_box_get_instance_private(box);
-	this->properties = map_init();
+	this->properties = NULL;
+	this->count = 0;
+	this->capacity = 0;
 }
 
 static void finalize(GObject* obj) {
 	WofiPropertyBoxPrivate* this = wofi_property_box_get_instance_private(WOFI_PROPERTY_BOX(obj));
-	map_free(this->properties);
+	for(size_t count = 0; count < this->count; ++count) {
+		free(this->properties[count].key);
+	}
+	free(this->properties);
 	G_OBJECT_CLASS(wofi_property_box_parent_class)->finalize(obj);
 }
 
@@ -49,12 +63,41 @@ GtkWidget* wofi_property_box_new(GtkOrientation orientation, gint spacing) {
 	return g_object_new(WOFI_TYPE_PROPERTY_BOX, "orientation", orientation, "spacing", spacing, NULL);
 }
 
+static struct property* find(WofiPropertyBoxPrivate* this, const gchar* key) {
+	for(size_t count = 0; count < this->count; ++count) {
+		if(strcmp(this->properties[count].key, key) == 0) {
+			return this->properties + count;
+		}
+	}
+	return NULL;
+}
+
 void wofi_property_box_add_property(WofiPropertyBox* box, const gchar* key, gchar* value) {
 	WofiPropertyBoxPrivate* this = wofi_property_box_get_instance_private(box);
-	map_put(this->properties, key, value);
+	struct property* property = find(this, key);
+	if(property != NULL) {
+		free(property->key);
+	} else {
+		if(this->count == this->capacity) {
+			this->capacity = this->capacity == 0 ? 4 : this->capacity * 2;
+			this->properties = realloc(this->properties, this->capacity * sizeof(struct property));
+		}
+		property = this->properties + this->count++;
+	}
+
+	size_t key_len = strlen(key) + 1;
+	size_t value_len = value == NULL ? 0 : strlen(value) + 1;
+	property->key = malloc(key_len + value_len);
+	memcpy(property->key, key, key_len);
+	property->value = NULL;
+	if(value != NULL) {
+		property->value = property->key + key_len;
+		memcpy(property->value, value, value_len);
+	}
 }
 
 const gchar* wofi_property_box_get_property(WofiPropertyBox* box, const gchar* key) {
 	WofiPropertyBoxPrivate* this = wofi_property_box_get_instance_private(box);
-	return map_get(this->properties, key);
+	struct property* property = find(this, key);
+	return property == NULL ? NULL : property->value;
 }
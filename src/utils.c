@@ -17,6 +17,8 @@
 
 #include <utils.h>
 
+#include <fcntl.h>
+#include <dirent.h>
 #include <libgen.h>
 #include <math.h>
 #include <stdarg.h>
@@ -24,10 +26,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#include <map.h>
+
+#define ARENA_BLOCK 65536
+//The same alignment malloc gives
+#define ARENA_ALIGN (2 * sizeof(void*))
+
+struct arena_block {
+	struct arena_block* next;
+	size_t size, used;
+	char data[];
+};
+
+struct utils_arena {
+	struct arena_block* blocks;
+};
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct map* interned = NULL;
+
 time_t utils_get_time_millis(void) {
 	struct timeval time;
 	gettimeofday(&time, NULL);
@@ -117,3 +139,120 @@ void utils_mkdir(char* path, mode_t mode) {
 		free(tmp);
 	}
 }
+
+//Interned strings live until wofi exits, two of them are equal only if they're the same pointer
+const char* utils_intern(const char* str) {
+	pthread_mutex_lock(&intern_lock);
+	if(interned == NULL) {
+		interned = map_init_borrowed();
+	}
+	char* ret = map_get(interned, str);
+	if(ret == NULL) {
+		ret = strdup(str);
+		map_put_void(interned, ret, ret);
+	}
+	pthread_mutex_unlock(&intern_lock);
+	return ret;
+}
+
+struct utils_arena* utils_arena_new(void) {
+	return calloc(1, sizeof(struct utils_arena));
+}
+
+static struct arena_block* new_block(size_t size) {
+	struct arena_block* block = malloc(sizeof(struct arena_block) + size);
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+static void* block_alloc(struct arena_block* block, size_t size) {
+	uintptr_t start = (uintptr_t) (block->data + block->used);
+	size_t padding = ((start + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1)) - start;
+	if(block->size - block->used < padding + size) {
+		return NULL;
+	}
+	block->used += padding + size;
+	return (void*) (start + padding);
+}
+
+//Not thread safe, anything shared between threads has to be locked by the caller
+void* utils_arena_alloc(struct utils_arena* arena, size_t size) {
+	void* ret = arena->blocks == NULL ? NULL : block_alloc(arena->blocks, size);
+	if(ret != NULL) {
+		return ret;
+	}
+	//Big allocations get a block of their own behind the current one so its free space isn't wasted
+	if(size + ARENA_ALIGN > ARENA_BLOCK / 4) {
+		struct arena_block* block = new_block(size + ARENA_ALIGN);
+		if(arena->blocks == NULL) {
+			block->next = NULL;
+			arena->blocks = block;
+		} else {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		}
+		return block_alloc(block, size);
+	}
+	struct arena_block* block = new_block(ARENA_BLOCK);
+	block->next = arena->blocks;
+	arena->blocks = block;
+	return block_alloc(block, size);
+}
+
+char* utils_arena_strdup(struct utils_arena* arena, const char* str) {
+	size_t len = strlen(str) + 1;
+	char* ret = utils_arena_alloc(arena, len);
+	memcpy(ret, str, len);
+	return ret;
+}
+
+void utils_arena_free(struct utils_arena* arena) {
+	struct arena_block* block = arena->blocks;
+	while(block != NULL) {
+		struct arena_block* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(arena);
+}
+
+int utils_open_dir(int at_fd, const char* path) {
+	return openat(at_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+//Takes ownership of dir_fd. Entries are only stat'ed when readdir can't tell what they are, which is also the case for symlinks
+void utils_scan_dir(int dir_fd, int flags, utils_scan_func func, void* data) {
+	DIR* dir = fdopendir(dir_fd);
+	if(dir == NULL) {
+		close(dir_fd);
+		return;
+	}
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL) {
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		bool is_dir = entry->d_type == DT_DIR;
+		bool is_file = entry->d_type == DT_REG;
+		if(entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+			struct stat info;
+			if(fstatat(dir_fd, entry->d_name, &info, 0) == -1) {
+				continue;
+			}
+			is_dir = S_ISDIR(info.st_mode);
+			is_file = S_ISREG(info.st_mode);
+		}
+
+		if(is_dir && (flags & UTILS_SCAN_DIRS) == UTILS_SCAN_DIRS) {
+			func(dir_fd, entry->d_name, true, data);
+		} else if(is_file && (flags & UTILS_SCAN_FILES) == UTILS_SCAN_FILES) {
+			if((flags & UTILS_SCAN_EXECUTABLE) == UTILS_SCAN_EXECUTABLE && faccessat(dir_fd, entry->d_name, X_OK, 0) != 0) {
+				continue;
+			}
+			func(dir_fd, entry->d_name, false, data);
+		}
+	}
+	closedir(dir);
+}
@@ -19,13 +19,32 @@
 
 #include <wofi.h>
 #include <utils.h>
+#include <utils_g.h>
 
+enum widget_part_type {
+	WIDGET_PART_TEXT,
+	WIDGET_PART_IMAGE,
+	WIDGET_PART_ICON
+};
+
+struct widget_part {
+	enum widget_part_type type;
+	char* text;
+	GdkPixbuf* pixbuf;
+	GIcon* icon;
+	struct wl_list classes;
+	struct wl_list link;
+};
+
+//Everything a builder holds comes from its mode's arena, so replaced text is only freed along with the arena
 struct widget_builder* wofi_widget_builder_init(struct mode* mode, size_t actions) {
-	struct widget_builder* builder = calloc(actions, sizeof(struct widget_builder));
+	wofi_arena_hold(mode);
+	struct widget_builder* builder = wofi_arena_alloc(mode, actions * sizeof(struct widget_builder));
+	memset(builder, 0, actions * sizeof(struct widget_builder));
 
 	for(size_t count = 0; count < actions; ++count) {
 		builder[count].mode = mode;
-		builder[count].box = WOFI_PROPERTY_BOX(wofi_property_box_new(GTK_ORIENTATION_HORIZONTAL, 0));
+		wl_list_init(&builder[count].parts);
 
 		if(count == 0) {
 			builder->actions = actions;
@@ -35,11 +54,11 @@ struct widget_builder* wofi_widget_builder_init(struct mode* mode, size_t action
 }
 
 void wofi_widget_builder_set_search_text(struct widget_builder* builder, char* search_text) {
-	wofi_property_box_add_property(builder->box, "filter", search_text);
+	builder->search_text = wofi_arena_strdup(builder->mode, search_text);
 }
 
 void wofi_widget_builder_set_action(struct widget_builder* builder, char* action) {
-	wofi_property_box_add_property(builder->box, "action", action);
+	builder->action = wofi_arena_strdup(builder->mode, action);
 }
 
 static void va_to_list(struct wl_list* classes, va_list args) {
@@ -51,6 +70,43 @@ static void va_to_list(struct wl_list* classes, va_list args) {
 	}
 }
 
+static void free_list(struct wl_list* classes) {
+	struct css_class* node, *tmp;
+	wl_list_for_each_safe(node, tmp, classes, link) {
+		free(node);
+	}
+}
+
+static char* class_name(const char* mode, const char* class) {
+	char buffer[128];
+	int len = snprintf(buffer, sizeof(buffer), "%s-%s", mode, class);
+	if(len >= 0 && (size_t) len < sizeof(buffer)) {
+		return (char*) utils_intern(buffer);
+	}
+	char* name = utils_concat(3, mode, "-", class);
+	const char* ret = utils_intern(name);
+	free(name);
+	return (char*) ret;
+}
+
+static struct widget_part* add_part(struct widget_builder* builder, enum widget_part_type type, struct wl_list* classes) {
+	struct widget_part* part = wofi_arena_alloc(builder->mode, sizeof(struct widget_part));
+	memset(part, 0, sizeof(struct widget_part));
+	part->type = type;
+	wl_list_init(&part->classes);
+
+	struct css_class* node;
+	wl_list_for_each_reverse(node, classes, link) {
+		struct css_class* class = wofi_arena_alloc(builder->mode, sizeof(struct css_class));
+		//The same few classes are on every entry of a mode so they're only stored once
+		class->class = class_name(builder->mode->name, node->class);
+		wl_list_insert(&part->classes, &class->link);
+	}
+
+	wl_list_insert(builder->parts.prev, &part->link);
+	return part;
+}
+
 void wofi_widget_builder_insert_text(struct widget_builder* builder, const char* text, ...) {
 	struct wl_list classes;
 	wl_list_init(&classes);
@@ -62,25 +118,12 @@ void wofi_widget_builder_insert_text(struct widget_builder* builder, const char*
 
 	wofi_widget_builder_insert_text_with_list(builder, text, &classes);
 
-	struct css_class* node, *tmp;
-	wl_list_for_each_safe(node, tmp, &classes, link) {
-		free(node);
-	}
+	free_list(&classes);
 }
 
 void wofi_widget_builder_insert_text_with_list(struct widget_builder* builder, const char* text, struct wl_list* classes) {
-	GtkWidget* label = gtk_label_new(text);
-	gtk_container_add(GTK_CONTAINER(builder->box), label);
-	gtk_widget_set_name(label, "text");
-
-	GtkStyleContext* ctx = gtk_widget_get_style_context(label);
-
-	struct css_class* node;
-	wl_list_for_each(node, classes, link) {
-		char* tmp = utils_concat(3, builder->mode->name, "-", node->class);
-		gtk_style_context_add_class(ctx, tmp);
-		free(tmp);
-	}
+	struct widget_part* part = add_part(builder, WIDGET_PART_TEXT, classes);
+	part->text = wofi_arena_strdup(builder->mode, text);
 }
 
 void wofi_widget_builder_insert_image(struct widget_builder* builder, GdkPixbuf* pixbuf, ...) {
@@ -94,28 +137,31 @@ void wofi_widget_builder_insert_image(struct widget_builder* builder, GdkPixbuf*
 
 	wofi_widget_builder_insert_image_with_list(builder, pixbuf, &classes);
 
-	struct css_class* node, *tmp;
-	wl_list_for_each_safe(node, tmp, &classes, link) {
-		free(node);
-	}
+	free_list(&classes);
 }
 
 void wofi_widget_builder_insert_image_with_list(struct widget_builder* builder, GdkPixbuf* pixbuf, struct wl_list* classes) {
-	GtkWidget* img = gtk_image_new();
-	cairo_surface_t* surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, wofi_get_window_scale(), gtk_widget_get_window(img));
-	gtk_image_set_from_surface(GTK_IMAGE(img), surface);
-	cairo_surface_destroy(surface);
-	gtk_container_add(GTK_CONTAINER(builder->box), img);
-	gtk_widget_set_name(img, "img");
+	struct widget_part* part = add_part(builder, WIDGET_PART_IMAGE, classes);
+	part->pixbuf = g_object_ref(pixbuf);
+}
 
-	GtkStyleContext* ctx = gtk_widget_get_style_context(img);
+void wofi_widget_builder_insert_icon(struct widget_builder* builder, GIcon* icon, ...) {
+	struct wl_list classes;
+	wl_list_init(&classes);
 
-	struct css_class* node;
-	wl_list_for_each(node, classes, link) {
-		char* tmp = utils_concat(3, builder->mode->name, "-", node->class);
-		gtk_style_context_add_class(ctx, tmp);
-		free(tmp);
-	}
+	va_list args;
+	va_start(args, icon);
+	va_to_list(&classes, args);
+	va_end(args);
+
+	wofi_widget_builder_insert_icon_with_list(builder, icon, &classes);
+
+	free_list(&classes);
+}
+
+void wofi_widget_builder_insert_icon_with_list(struct widget_builder* builder, GIcon* icon, struct wl_list* classes) {
+	struct widget_part* part = add_part(builder, WIDGET_PART_ICON, classes);
+	part->icon = g_object_ref(icon);
 }
 
 struct widget_builder* wofi_widget_builder_get_idx(struct widget_builder* builder, size_t idx) {
@@ -129,20 +175,177 @@ struct widget* wofi_widget_builder_get_widget(struct widget_builder* builder) {
 	}
 
 	if(builder->widget == NULL) {
-		builder->widget = malloc(sizeof(struct widget));
+		builder->widget = wofi_arena_alloc(builder->mode, sizeof(struct widget));
+		memset(builder->widget, 0, sizeof(struct widget));
 		builder->widget->builder = builder;
 		builder->widget->action_count = builder->actions;
 	}
 
-	for(size_t count = 0; count < builder->actions; ++count) {
+	return builder->widget;
+}
+
+static GdkPixbuf* load_icon(GIcon* icon) {
+	uint64_t size = wofi_get_image_size() * wofi_get_window_scale();
+	GdkPixbuf* pixbuf = NULL;
+	if(G_IS_FILE_ICON(icon)) {
+		GFile* file = g_file_icon_get_file(G_FILE_ICON(icon));
+		char* path = g_file_get_path(file);
+		if(path != NULL) {
+			pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+			g_free(path);
+		}
+	} else {
+		GtkIconTheme* theme = gtk_icon_theme_get_default();
+		GtkIconInfo* info = NULL;
+		if(G_IS_THEMED_ICON(icon)) {
+			const gchar* const* icon_names = g_themed_icon_get_names(G_THEMED_ICON(icon));
+			info = gtk_icon_theme_choose_icon_for_scale(theme, (const gchar**) icon_names, wofi_get_image_size(), wofi_get_window_scale(), 0);
+		}
+		if(info == NULL) {
+			info = gtk_icon_theme_lookup_icon_for_scale(theme, "application-x-executable", wofi_get_image_size(), wofi_get_window_scale(), 0);
+		}
+		if(info != NULL) {
+			pixbuf = gtk_icon_info_load_icon(info, NULL);
+			g_object_unref(info);
+		}
 	}
 
-	return builder->widget;
+	if(pixbuf == NULL) {
+		return NULL;
+	}
+	return utils_g_resize_pixbuf(pixbuf, size, GDK_INTERP_BILINEAR);
+}
+
+static void add_classes(GtkWidget* widget, struct wl_list* classes) {
+	GtkStyleContext* ctx = gtk_widget_get_style_context(widget);
+
+	struct css_class* node;
+	wl_list_for_each(node, classes, link) {
+		gtk_style_context_add_class(ctx, node->class);
+	}
+}
+
+static void realize_image(WofiPropertyBox* box, GdkPixbuf* pixbuf, struct wl_list* classes) {
+	GtkWidget* img = gtk_image_new();
+	cairo_surface_t* surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, wofi_get_window_scale(), gtk_widget_get_window(img));
+	gtk_image_set_from_surface(GTK_IMAGE(img), surface);
+	cairo_surface_destroy(surface);
+	gtk_container_add(GTK_CONTAINER(box), img);
+	gtk_widget_set_name(img, "img");
+
+	add_classes(img, classes);
+}
+
+WofiPropertyBox* wofi_widget_builder_realize(struct widget_builder* builder) {
+	WofiPropertyBox* box = WOFI_PROPERTY_BOX(wofi_property_box_new(GTK_ORIENTATION_HORIZONTAL, 0));
+
+	if(builder->search_text != NULL) {
+		wofi_property_box_add_property(box, "filter", builder->search_text);
+	}
+	if(builder->action != NULL) {
+		wofi_property_box_add_property(box, "action", builder->action);
+	}
+
+	struct widget_part* part;
+	wl_list_for_each(part, &builder->parts, link) {
+		switch(part->type) {
+		case WIDGET_PART_TEXT: {
+			GtkWidget* label = gtk_label_new(part->text);
+			gtk_container_add(GTK_CONTAINER(box), label);
+			gtk_widget_set_name(label, "text");
+			add_classes(label, &part->classes);
+			break;
+		}
+		case WIDGET_PART_IMAGE:
+			realize_image(box, part->pixbuf, &part->classes);
+			break;
+		case WIDGET_PART_ICON: {
+			GdkPixbuf* pixbuf = load_icon(part->icon);
+			if(pixbuf != NULL) {
+				realize_image(box, pixbuf, &part->classes);
+				g_object_unref(pixbuf);
+			}
+			break;
+		}
+		}
+	}
+	return box;
+}
+
+static void free_parts(struct widget_builder* builder) {
+	struct widget_part* part, *tmp;
+	wl_list_for_each_safe(part, tmp, &builder->parts, link) {
+		if(part->pixbuf != NULL) {
+			g_object_unref(part->pixbuf);
+		}
+		if(part->icon != NULL) {
+			g_object_unref(part->icon);
+		}
+		if(builder->detached) {
+			free_list(&part->classes);
+			free(part->text);
+			free(part);
+		}
+	}
+	if(builder->detached) {
+		free(builder->search_text);
+		free(builder->action);
+	}
 }
 
 void wofi_widget_builder_free(struct widget_builder* builder) {
-	if(builder->widget != NULL) {
+	for(size_t count = 0; count < builder->actions; ++count) {
+		free_parts(builder + count);
+	}
+	if(builder->detached) {
 		free(builder->widget);
+		free(builder);
+	} else {
+		wofi_arena_release(builder->mode);
+	}
+}
+
+static char* strdup_null(const char* str) {
+	return str == NULL ? NULL : strdup(str);
+}
+
+//Copies the builders out of their mode's arena into allocations of their own and frees the originals
+struct widget_builder* wofi_widget_builder_detach(struct widget_builder* builder) {
+	size_t actions = builder->actions;
+	struct widget_builder* copy = calloc(actions, sizeof(struct widget_builder));
+	for(size_t count = 0; count < actions; ++count) {
+		struct widget_builder* src = builder + count;
+		struct widget_builder* dest = copy + count;
+		dest->mode = src->mode;
+		dest->detached = true;
+		dest->search_text = strdup_null(src->search_text);
+		dest->action = strdup_null(src->action);
+		wl_list_init(&dest->parts);
+
+		struct widget_part* part;
+		wl_list_for_each(part, &src->parts, link) {
+			struct widget_part* new_part = calloc(1, sizeof(struct widget_part));
+			new_part->type = part->type;
+			new_part->text = strdup_null(part->text);
+			//The references move over to the copy
+			new_part->pixbuf = part->pixbuf;
+			new_part->icon = part->icon;
+			part->pixbuf = NULL;
+			part->icon = NULL;
+			wl_list_init(&new_part->classes);
+			struct css_class* node;
+			wl_list_for_each(node, &part->classes, link) {
+				struct css_class* class = malloc(sizeof(struct css_class));
+				class->class = node->class;
+				wl_list_insert(new_part->classes.prev, &class->link);
+			}
+			wl_list_insert(dest->parts.prev, &new_part->link);
+		}
 	}
-	free(builder);
+	copy->actions = actions;
+	copy->widget = calloc(1, sizeof(struct widget));
+	copy->widget->builder = copy;
+	copy->widget->action_count = actions;
+	wofi_widget_builder_free(builder);
+	return copy;
 }
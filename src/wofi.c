@@ -23,6 +23,7 @@
 #endif
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <libgen.h>
 #include <unistd.h>
@@ -32,8 +33,10 @@
 #include <sys/wait.h>
 
 #include <utils.h>
+#include <cache.h>
 #include <match.h>
 #include <config.h>
+#include <daemon.h>
 #include <utils_g.h>
 #include <property_box.h>
 #include <widget_builder.h>
@@ -108,9 +111,19 @@ static GdkRectangle resolution = {0};
 static bool resize_expander = false;
 static uint32_t line_count = 0;
 static bool dynamic_lines;
+static bool uniform_row_height;
+static guint resize_tick = 0;
+static guint search_source = 0;
+static guint loading_source = 0;
+static size_t loading_modes = 0;
+static uint64_t filter_rate;
+static gint64 filter_cost = 0;
+static GdkMonitor* percent_monitor = NULL;
 static struct wl_list mode_list;
 static pthread_t mode_thread;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool has_joined_mode = false;
+static bool exec_only = false;
 static char* copy_exec = NULL;
 static char* pre_display_cmd = NULL;
 static bool pre_display_exec = false;
@@ -128,6 +141,14 @@ static struct wl_surface* wl_surface;
 static struct wl_list outputs;
 static struct zxdg_output_manager_v1* output_manager;
 static struct zwlr_layer_surface_v1* wlr_surface;
+static struct zwlr_layer_surface_v1_listener* surface_listener;
+static struct wl_output* wlr_output = NULL;
+static enum zwlr_layer_shell_v1_layer wlr_layer;
+
+struct remove_request {
+	struct mode* mode;
+	char* action;
+};
 
 struct output_node {
 	char* name;
@@ -158,11 +179,30 @@ static void add_interface(void* data, struct wl_registry* registry, uint32_t nam
 	}
 }
 
+static void resize_window(void) {
+	gtk_window_resize(GTK_WINDOW(window), width, height);
+	if(entry == NULL) {
+		return;
+	}
+	GtkAllocation alloc;
+	gtk_widget_get_allocated_size(entry, &alloc, NULL);
+	if(outer_orientation == GTK_ORIENTATION_HORIZONTAL) {
+		if(alloc.width > 0) {
+			gtk_widget_set_size_request(scroll, width - alloc.width, height);
+		}
+	} else {
+		if(alloc.height > 0) {
+			gtk_widget_set_size_request(scroll, width, height - alloc.height);
+		}
+	}
+}
+
 static void config_surface(void* data, struct zwlr_layer_surface_v1* surface, uint32_t serial, uint32_t width, uint32_t height) {
 	(void) data;
 	(void) width;
 	(void) height;
 	zwlr_layer_surface_v1_ack_configure(surface, serial);
+	resize_window();
 }
 
 static void setup_surface(struct zwlr_layer_surface_v1* surface) {
@@ -216,10 +256,27 @@ static void setup_surface(struct zwlr_layer_surface_v1* surface) {
 	}
 }
 
+//GDK only creates the wl_surface when the window is realized so this has to run between realizing and showing it
+static void create_layer_surface(void) {
+	gdk_wayland_window_set_use_custom_surface(gtk_widget_get_window(window));
+	wl_surface = gdk_wayland_window_get_wl_surface(gtk_widget_get_window(window));
+	if(wl_surface == NULL) {
+		fprintf(stderr, "The window has no wayland surface to put on the layer shell\n");
+		wofi_exit(1);
+	}
+	wlr_surface = zwlr_layer_shell_v1_get_layer_surface(shell, wl_surface, wlr_output, wlr_layer, "wofi");
+	setup_surface(wlr_surface);
+	zwlr_layer_surface_v1_add_listener(wlr_surface, surface_listener, NULL);
+	wl_surface_commit(wl_surface);
+	wl_display_roundtrip(wl);
+}
+
 static gboolean do_search(gpointer data) {
 	(void) data;
+	search_source = 0;
 	const gchar* new_filter = gtk_entry_get_text(GTK_ENTRY(entry));
 	if(filter == NULL || strcmp(new_filter, filter) != 0) {
+		gint64 start = g_get_monotonic_time();
 		if(filter != NULL) {
 			free(filter);
 		}
@@ -230,8 +287,28 @@ static gboolean do_search(gpointer data) {
 		if(child != NULL) {
 			gtk_flow_box_select_child(GTK_FLOW_BOX(inner_box), child);
 		}
+		filter_cost = g_get_monotonic_time() - start;
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void search_changed(GtkEditable* editable, gpointer data) {
+	(void) editable;
+	(void) data;
+	if(search_source != 0) {
+		return;
+	}
+
+	//Cheap passes run right away, expensive ones wait as long as the last pass took so typing stays responsive
+	uint64_t delay = filter_cost / 1000;
+	if(delay > filter_rate) {
+		delay = filter_rate;
+	}
+	if(delay < 16) {
+		search_source = gdk_threads_add_idle(do_search, NULL);
+	} else {
+		search_source = gdk_threads_add_timeout(delay, do_search, NULL);
 	}
-	return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -462,11 +539,11 @@ char* wofi_parse_image_escapes(const char* text) {
 	return parse_images(NULL, text, false);
 }
 
+//mode is always an interned mode name so it's stored as is and compared by pointer
 static void setup_label(char* mode, WofiPropertyBox* box) {
-	wofi_property_box_add_property(box, "mode", mode);
-	char index[11];
-	snprintf(index, sizeof(index), "%u", ++widget_count);
-	wofi_property_box_add_property(box, "index", index);
+	g_object_set_data(G_OBJECT(box), "mode", mode);
+	//Widgets are inserted in rank order so this is the entry's rank, it's kept as a number so sorting doesn't have to parse it
+	g_object_set_data(G_OBJECT(box), "index", GUINT_TO_POINTER(++widget_count));
 
 	gtk_widget_set_name(GTK_WIDGET(box), "unselected");
 
@@ -620,7 +697,18 @@ static char* get_cache_path(const gchar* mode) {
 }
 
 static void execute_action(const gchar* mode, const gchar* cmd) {
+	//The selection is run by the client that asked to be shown so it inherits that client's environment and stdout
+	if(wofi_daemon_has_client()) {
+		wofi_daemon_reply_exec(mode, cmd, mod_shift, mod_ctrl, custom_key_return_code);
+		wofi_hide();
+		return;
+	}
+	//A daemon client gets the mode name over the socket, it has to be one that was loaded
 	struct mode* mode_ptr = map_get(modes, mode);
+	if(mode_ptr == NULL) {
+		fprintf(stderr, "The wofi daemon replied with unknown mode %s\n", mode);
+		wofi_exit(1);
+	}
 	mode_ptr->mode_exec(cmd);
 }
 
@@ -632,38 +720,184 @@ static void activate_item(GtkFlowBox* flow_box, GtkFlowBoxChild* row, gpointer d
 	if(primary_action) {
 		box = gtk_expander_get_label_widget(GTK_EXPANDER(box));
 	}
-	execute_action(wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "mode"), wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "action"));
+	execute_action(g_object_get_data(G_OBJECT(box), "mode"), wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "action"));
+}
+
+void wofi_arena_hold(struct mode* mode) {
+	pthread_mutex_lock(&arena_lock);
+	if(mode->arena == NULL) {
+		mode->arena = utils_arena_new();
+	}
+	++mode->arena_users;
+	pthread_mutex_unlock(&arena_lock);
+}
+
+//Entries are created on the mode thread and freed on the main thread so every use of the arena is locked
+void* wofi_arena_alloc(struct mode* mode, size_t size) {
+	pthread_mutex_lock(&arena_lock);
+	void* ret = utils_arena_alloc(mode->arena, size);
+	pthread_mutex_unlock(&arena_lock);
+	return ret;
+}
+
+char* wofi_arena_strdup(struct mode* mode, const char* str) {
+	pthread_mutex_lock(&arena_lock);
+	char* ret = utils_arena_strdup(mode->arena, str);
+	pthread_mutex_unlock(&arena_lock);
+	return ret;
+}
+
+void wofi_arena_release(struct mode* mode) {
+	pthread_mutex_lock(&arena_lock);
+	if(--mode->arena_users == 0) {
+		utils_arena_free(mode->arena);
+		mode->arena = NULL;
+	}
+	pthread_mutex_unlock(&arena_lock);
+}
+
+//A detached widget is a plain allocation of its own which doesn't keep the mode's arena around
+static struct widget* alloc_widget(struct mode* mode, bool detached, size_t action_count, size_t strings_size) {
+	size_t size = sizeof(struct widget) + action_count * 2 * sizeof(char*) + strings_size;
+	struct widget* widget;
+	if(detached) {
+		widget = malloc(size);
+		memset(widget, 0, sizeof(struct widget));
+	} else {
+		wofi_arena_hold(mode);
+		widget = wofi_arena_alloc(mode, size);
+		memset(widget, 0, sizeof(struct widget));
+		widget->owner = mode;
+	}
+	widget->mode = mode->name;
+	widget->action_count = action_count;
+	widget->text = (char**) (widget + 1);
+	widget->actions = widget->text + action_count;
+	return widget;
+}
+
+static char* pack_string(char** dest, char* pos, const char* str) {
+	size_t len = strlen(str) + 1;
+	memcpy(pos, str, len);
+	*dest = pos;
+	return pos + len;
+}
+
+//The widget, its arrays and its strings are all one allocation
+static struct widget* pack_widget(struct mode* mode, bool detached, char* text[], char* search_text, char* actions[], size_t action_count) {
+	size_t strings_size = strlen(search_text) + 1;
+	for(size_t count = 0; count < action_count; ++count) {
+		strings_size += strlen(text[count]) + strlen(actions[count]) + 2;
+	}
+	struct widget* widget = alloc_widget(mode, detached, action_count, strings_size);
+	char* pos = (char*) (widget->actions + action_count);
+	for(size_t count = 0; count < action_count; ++count) {
+		pos = pack_string(&widget->text[count], pos, text[count]);
+		pos = pack_string(&widget->actions[count], pos, actions[count]);
+	}
+	pack_string(&widget->search_text, pos, search_text);
+	return widget;
+}
+
+struct widget* wofi_create_widget(struct mode* mode, char* text[], char* search_text, char* actions[], size_t action_count) {
+	return pack_widget(mode, false, text, search_text, actions, action_count);
+}
+
+struct widget* wofi_create_widget_borrowed(struct mode* mode, char* text[], char* search_text, char* actions[], size_t action_count) {
+	struct widget* widget = alloc_widget(mode, false, action_count, 0);
+	memcpy(widget->text, text, action_count * sizeof(char*));
+	widget->search_text = search_text;
+	memcpy(widget->actions, actions, action_count * sizeof(char*));
+	return widget;
+}
+
+static void free_widget(gpointer data) {
+	struct widget* node = data;
+	if(node->builder != NULL) {
+		wofi_widget_builder_free(node->builder);
+	} else if(node->owner != NULL) {
+		wofi_arena_release(node->owner);
+	} else {
+		free(node);
+	}
+}
+
+//An expander holds on to its entry until it's expanded, which may be never, so it gets a copy rather than pinning the whole arena
+static struct widget* detach_widget(struct widget* node) {
+	struct widget* copy;
+	if(node->builder != NULL) {
+		copy = wofi_widget_builder_get_widget(wofi_widget_builder_detach(node->builder));
+	} else {
+		copy = pack_widget(node->owner, true, node->text, node->search_text, node->actions, node->action_count);
+		free_widget(node);
+	}
+	return copy;
+}
+
+static GtkWidget* create_action_box(GtkExpander* expander) {
+	struct widget* node = g_object_get_data(G_OBJECT(expander), "widget");
+
+	GtkWidget* exp_box = gtk_list_box_new();
+	gtk_widget_set_name(exp_box, "expander-box");
+	gtk_list_box_set_activate_on_single_click(GTK_LIST_BOX(exp_box), single_click);
+	g_signal_connect(exp_box, "row-activated", G_CALLBACK(activate_item), NULL);
+	gtk_container_add(GTK_CONTAINER(expander), exp_box);
+	for(size_t count = 1; count < node->action_count; ++count) {
+		GtkWidget* box;
+		if(node->builder == NULL) {
+			box = create_label(node->mode, node->text[count], node->search_text, node->actions[count]);
+		} else {
+			box = GTK_WIDGET(wofi_widget_builder_realize(wofi_widget_builder_get_idx(node->builder, count)));
+			setup_label(node->builder->mode->name, WOFI_PROPERTY_BOX(box));
+		}
+
+		GtkWidget* row = gtk_list_box_row_new();
+		gtk_widget_set_name(row, "entry");
+
+		gtk_container_add(GTK_CONTAINER(row), box);
+		gtk_container_add(GTK_CONTAINER(exp_box), row);
+	}
+	gtk_widget_show_all(exp_box);
+
+	//Dropping the data frees the entry now that every action has a widget
+	g_object_set_data(G_OBJECT(expander), "widget", NULL);
+	return exp_box;
 }
 
 static void expand(GtkExpander* expander, gpointer data) {
 	(void) data;
 	GtkWidget* box = gtk_bin_get_child(GTK_BIN(expander));
+	if(box == NULL) {
+		box = create_action_box(expander);
+	}
 	resize_expander = !gtk_expander_get_expanded(expander);
 	gtk_widget_set_visible(box, resize_expander);
 }
 
-static void update_surface_size(void) {
+static gboolean apply_surface_size(GtkWidget* widget, GdkFrameClock* clock, gpointer data) {
+	(void) widget;
+	(void) clock;
+	(void) data;
+	resize_tick = 0;
 	if(lines > 0) {
 		height = max_height * lines;
 		height += 5;
 	}
-	if(shell != NULL) {
+	if(shell != NULL && wlr_surface != NULL) {
+		//The window itself is resized once the compositor configures the new size
 		zwlr_layer_surface_v1_set_size(wlr_surface, width, height);
 		wl_surface_commit(wl_surface);
-		wl_display_roundtrip(wl);
+		wl_display_flush(wl);
+	} else {
+		resize_window();
 	}
+	return G_SOURCE_REMOVE;
+}
 
-	gtk_window_resize(GTK_WINDOW(window), width, height);
-	GtkAllocation alloc;
-	gtk_widget_get_allocated_size(entry, &alloc, NULL);
-	if(outer_orientation == GTK_ORIENTATION_HORIZONTAL) {
-		if(alloc.width > 0) {
-			gtk_widget_set_size_request(scroll, width - alloc.width, height);
-		}
-	} else {
-		if(alloc.height > 0) {
-			gtk_widget_set_size_request(scroll, width, height - alloc.height);
-		}
+static void update_surface_size(void) {
+	//Any number of requests within a frame collapse into a single resize
+	if(resize_tick == 0) {
+		resize_tick = gtk_widget_add_tick_callback(window, apply_surface_size, NULL, NULL);
 	}
 }
 
@@ -701,10 +935,21 @@ static void widget_allocate(GtkWidget* widget, GdkRectangle* allocation, gpointe
 	}
 }
 
+//With uniform rows the first row is used as the template for every other row
+static void measure_row_height(GtkWidget* row) {
+	gint natural_height;
+	gtk_widget_get_preferred_height(row, NULL, &natural_height);
+	max_height = natural_height;
+	if(lines > 0) {
+		update_surface_size();
+	}
+}
+
 static gboolean _insert_widget(gpointer data) {
 	struct mode* mode = data;
 	struct widget* node;
-	if(mode->mode_get_widget == NULL) {
+	//A daemon client only loads its modes to execute the selection, there's no window to insert into
+	if(mode->mode_get_widget == NULL || inner_box == NULL) {
 		return FALSE;
 	} else {
 		node = mode->mode_get_widget();
@@ -721,35 +966,19 @@ static gboolean _insert_widget(gpointer data) {
 		if(node->builder == NULL) {
 			box = create_label(node->mode, node->text[0], node->search_text, node->actions[0]);
 		} else {
-			box = GTK_WIDGET(node->builder->box);
+			box = GTK_WIDGET(wofi_widget_builder_realize(node->builder));
 			setup_label(node->builder->mode->name, WOFI_PROPERTY_BOX(box));
 		}
 		gtk_expander_set_label_widget(GTK_EXPANDER(parent), box);
 
-		GtkWidget* exp_box = gtk_list_box_new();
-		gtk_widget_set_name(exp_box, "expander-box");
-		gtk_list_box_set_activate_on_single_click(GTK_LIST_BOX(exp_box), single_click);
-		g_signal_connect(exp_box, "row-activated", G_CALLBACK(activate_item), NULL);
-		gtk_container_add(GTK_CONTAINER(parent), exp_box);
-		for(size_t count = 1; count < node->action_count; ++count) {
-			if(node->builder == NULL) {
-				box = create_label(node->mode, node->text[count], node->search_text, node->actions[count]);
-			} else {
-				box = GTK_WIDGET(node->builder[count].box);
-				setup_label(node->builder->mode->name, WOFI_PROPERTY_BOX(box));
-			}
-
-			GtkWidget* row = gtk_list_box_row_new();
-			gtk_widget_set_name(row, "entry");
-
-			gtk_container_add(GTK_CONTAINER(row), box);
-			gtk_container_add(GTK_CONTAINER(exp_box), row);
-		}
+		//The action rows are only built if the entry is ever expanded
+		node = detach_widget(node);
+		g_object_set_data_full(G_OBJECT(parent), "widget", node, free_widget);
 	} else {
 		if(node->builder == NULL) {
 			parent = create_label(node->mode, node->text[0], node->search_text, node->actions[0]);
 		} else {
-			parent = GTK_WIDGET(node->builder->box);
+			parent = GTK_WIDGET(wofi_widget_builder_realize(node->builder));
 			setup_label(node->builder->mode->name, WOFI_PROPERTY_BOX(parent));
 		}
 	}
@@ -757,38 +986,30 @@ static gboolean _insert_widget(gpointer data) {
 	gtk_widget_set_halign(parent, content_halign);
 	GtkWidget* child = gtk_flow_box_child_new();
 	gtk_widget_set_name(child, "entry");
-	g_signal_connect(child, "size-allocate", G_CALLBACK(widget_allocate), NULL);
+	if(!uniform_row_height) {
+		g_signal_connect(child, "size-allocate", G_CALLBACK(widget_allocate), NULL);
+	}
 
 	gtk_container_add(GTK_CONTAINER(child), parent);
 	gtk_widget_show_all(child);
 	gtk_container_add(GTK_CONTAINER(inner_box), child);
 	++line_count;
 
+	if(uniform_row_height) {
+		if(max_height == 0) {
+			measure_row_height(child);
+		}
+		gtk_widget_set_size_request(child, -1, max_height);
+	}
+
 	if(!user_moved) {
 		GtkFlowBoxChild* child = gtk_flow_box_get_child_at_index(GTK_FLOW_BOX(inner_box), 0);
 		gtk_flow_box_select_child(GTK_FLOW_BOX(inner_box), child);
 		gtk_widget_grab_focus(GTK_WIDGET(child));
 	}
 
-	if(GTK_IS_EXPANDER(parent)) {
-		GtkWidget* box = gtk_bin_get_child(GTK_BIN(parent));
-		gtk_widget_set_visible(box, FALSE);
-	}
-
-	if(node->builder != NULL) {
-		wofi_widget_builder_free(node->builder);
-	} else {
-		free(node->mode);
-		for(size_t count = 0; count < node->action_count; ++count) {
-			free(node->text[count]);
-		}
-		free(node->text);
-		free(node->search_text);
-		for(size_t count = 0; count < node->action_count; ++count) {
-			free(node->actions[count]);
-		}
-		free(node->actions);
-		free(node);
+	if(!GTK_IS_EXPANDER(parent)) {
+		free_widget(node);
 	}
 	return TRUE;
 }
@@ -810,232 +1031,108 @@ static gboolean insert_all_widgets(gpointer data) {
 	}
 }
 
-static char* escape_lf(const char* cmd) {
-	size_t len = strlen(cmd);
-	char* buffer = calloc(1, (len + 1) * 2);
-
-	size_t buf_count = 0;
-	for(size_t count = 0; count < len; ++count) {
-		char chr = cmd[count];
-		if(chr == '\n') {
-			buffer[buf_count++] = '\\';
-			buffer[buf_count++] = 'n';
-		} else if(chr == '\\') {
-			buffer[buf_count++] = '\\';
-			buffer[buf_count++] = '\\';
-		} else {
-			buffer[buf_count++] = chr;
-		}
-	}
-	return buffer;
+void wofi_write_cache(struct mode* mode, const char* cmd) {
+	char* cache_path = get_cache_path(mode->name);
+	cache_increment(cache_path, cmd);
+	cache_commit_detached(cache_path);
+	free(cache_path);
 }
 
-static char* remove_escapes(const char* cmd) {
-	size_t len = strlen(cmd);
-	char* buffer = calloc(1, len + 1);
-
-	size_t buf_count = 0;
-	for(size_t count = 0; count < len; ++count) {
-		char chr = cmd[count];
-		if(chr == '\\') {
-			chr = cmd[++count];
-			if(chr == 'n') {
-				buffer[buf_count++] = '\n';
-			} else if(chr == '\\') {
-				buffer[buf_count++] = '\\';
-			}
-		} else {
-			buffer[buf_count++] = chr;
-		}
-	}
-	return buffer;
+void wofi_remove_cache(struct mode* mode, const char* cmd) {
+	char* cache_path = get_cache_path(mode->name);
+	cache_remove(cache_path, cmd);
+	free(cache_path);
 }
 
-void wofi_write_cache(struct mode* mode, const char* _cmd) {
-	char* cmd = escape_lf(_cmd);
-
+struct wl_list* wofi_read_cache(struct mode* mode) {
 	char* cache_path = get_cache_path(mode->name);
+	struct wl_list* cache = cache_read(cache_path);
+	free(cache_path);
+	return cache;
+}
 
-	char* tmp_dir = strdup(cache_path);
-	utils_mkdir(dirname(tmp_dir), S_IRWXU | S_IRGRP | S_IXGRP);
-	free(tmp_dir);
+void wofi_insert_widgets(struct mode* mode) {
+	gdk_threads_add_idle(_insert_widget, mode);
+}
 
-	struct wl_list lines;
-	wl_list_init(&lines);
-	bool inc_count = false;
-	if(access(cache_path, R_OK) == 0) {
-		FILE* file = fopen(cache_path, "r");
-		char* line = NULL;
-		size_t size = 0;
-		while(getline(&line, &size, file) != -1) {
-			char* space = strchr(line, ' ');
-			char* lf = strchr(line, '\n');
-			if(lf != NULL) {
-				*lf = 0;
-			}
-			if(space != NULL && strcmp(cmd, space + 1) == 0) {
-				struct cache_line* node = malloc(sizeof(struct cache_line));
-				uint64_t count = strtol(line, NULL, 10) + 1;
-				char num[6];
-				snprintf(num, 5, "%" PRIu64, count);
-				node->line = utils_concat(4, num, " ", cmd, "\n");
-				inc_count = true;
-				wl_list_insert(&lines, &node->link);
-			}
+static gboolean _remove_widget(gpointer data) {
+	struct remove_request* request = data;
+	GList* children = inner_box == NULL ? NULL : gtk_container_get_children(GTK_CONTAINER(inner_box));
+	for(GList* list = children; list != NULL; list = list->next) {
+		GtkWidget* box = gtk_bin_get_child(GTK_BIN(list->data));
+		if(GTK_IS_EXPANDER(box)) {
+			box = gtk_expander_get_label_widget(GTK_EXPANDER(box));
 		}
-		free(line);
-		line = NULL;
-		size = 0;
-		fseek(file, 0, SEEK_SET);
-		while(getline(&line, &size, file) != -1) {
-			char* space = strchr(line, ' ');
-			char* nl = strchr(line, '\n');
-			if(nl != NULL) {
-				*nl = 0;
-			}
-			if(space == NULL || strcmp(cmd, space + 1) != 0) {
-				struct cache_line* node = malloc(sizeof(struct cache_line));
-				node->line = utils_concat(2, line, "\n");
-				wl_list_insert(&lines, &node->link);
-			}
+		const gchar* mode = g_object_get_data(G_OBJECT(box), "mode");
+		const gchar* action = wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "action");
+		if(mode != request->mode->name || action == NULL || strcmp(action, request->action) != 0) {
+			continue;
 		}
-		free(line);
-		fclose(file);
-	}
-	char* tmp_path = strdup(cache_path);
-	char* dir = dirname(tmp_path);
 
-	if(access(dir, W_OK) == 0) {
-		if(!inc_count) {
-			struct cache_line* node = malloc(sizeof(struct cache_line));
-			node->line = utils_concat(3, "1 ", cmd, "\n");
-			wl_list_insert(&lines, &node->link);
+		if(gtk_widget_get_visible(list->data)) {
+			--line_count;
+			if(dynamic_lines) {
+				lines = line_count < max_lines ? line_count : max_lines;
+				update_surface_size();
+			}
 		}
-		FILE* file = fopen(cache_path, "w");
-		struct cache_line* node, *tmp;
-		wl_list_for_each_safe(node, tmp, &lines, link) {
-			fwrite(node->line, 1, strlen(node->line), file);
-			free(node->line);
-			wl_list_remove(&node->link);
-			free(node);
+		if(box == previous_selection) {
+			previous_selection = NULL;
 		}
+		gtk_widget_destroy(list->data);
 
-		fclose(file);
-	}
-	free(cache_path);
-	free(tmp_path);
-	free(cmd);
-}
-
-void wofi_remove_cache(struct mode* mode, const char* _cmd) {
-	char* cmd = escape_lf(_cmd);
-
-	char* cache_path = get_cache_path(mode->name);
-	if(access(cache_path, R_OK | W_OK) == 0) {
-		struct wl_list lines;
-		wl_list_init(&lines);
-
-		FILE* file = fopen(cache_path, "r");
-		char* line = NULL;
-		size_t size = 0;
-		while(getline(&line, &size, file) != -1) {
-			char* space = strchr(line, ' ');
-			char* lf = strchr(line, '\n');
-			if(lf != NULL) {
-				*lf = 0;
+		if(!user_moved) {
+			GtkFlowBoxChild* child = gtk_flow_box_get_child_at_index(GTK_FLOW_BOX(inner_box), 0);
+			if(child != NULL) {
+				gtk_flow_box_select_child(GTK_FLOW_BOX(inner_box), child);
 			}
-			if(space == NULL || strcmp(cmd, space + 1) != 0) {
-				struct cache_line* node = malloc(sizeof(struct cache_line));
-				node->line = utils_concat(2, line, "\n");
-				wl_list_insert(&lines, &node->link);
-			}
-		}
-		free(line);
-		fclose(file);
-
-		file = fopen(cache_path, "w");
-		struct cache_line* node, *tmp;
-		wl_list_for_each_safe(node, tmp, &lines, link) {
-			fwrite(node->line, 1, strlen(node->line), file);
-			free(node->line);
-			wl_list_remove(&node->link);
-			free(node);
 		}
-		fclose(file);
 	}
-	free(cache_path);
-	free(cmd);
+	g_list_free(children);
+	free(request->action);
+	free(request);
+	return G_SOURCE_REMOVE;
 }
 
-struct wl_list* wofi_read_cache(struct mode* mode) {
-	char* cache_path = get_cache_path(mode->name);
-	struct wl_list* cache = malloc(sizeof(struct wl_list));
-	wl_list_init(cache);
-	struct wl_list lines;
-	wl_list_init(&lines);
-	if(access(cache_path, R_OK) == 0) {
-		FILE* file = fopen(cache_path, "r");
-		char* line = NULL;
-		size_t size = 0;
-		while(getline(&line, &size, file) != -1) {
-			struct cache_line* node = malloc(sizeof(struct cache_line));
-			char* lf = strchr(line, '\n');
-			if(lf != NULL) {
-				*lf = 0;
-			}
-			node->line = remove_escapes(line);
-			wl_list_insert(&lines, &node->link);
-		}
-		free(line);
-		fclose(file);
-	}
-	while(!wl_list_empty(&lines)) {
-		uint64_t smallest = UINT64_MAX;
-		struct cache_line* node, *smallest_node = NULL;
-		wl_list_for_each(node, &lines, link) {
-			uint64_t num = strtol(node->line, NULL, 10);
-			if(num < smallest) {
-				smallest = num;
-				smallest_node = node;
-			}
-		}
-
-		char* space = strchr(smallest_node->line, ' ');
-
-		if(space == NULL) {
-			free(smallest_node->line);
-			wl_list_remove(&smallest_node->link);
-			continue;
-		}
+void wofi_remove_widget(struct mode* mode, const char* action) {
+	struct remove_request* request = malloc(sizeof(struct remove_request));
+	request->mode = mode;
+	request->action = strdup(action);
+	gdk_threads_add_idle(_remove_widget, request);
+}
 
-		char* tmp = strdup(space + 1);
-		free(smallest_node->line);
-		smallest_node->line = tmp;
-		wl_list_remove(&smallest_node->link);
-		wl_list_insert(cache, &smallest_node->link);
-	}
-	free(cache_path);
-	return cache;
+static gboolean pulse_loading(gpointer data) {
+	(void) data;
+	gtk_entry_progress_pulse(GTK_ENTRY(entry));
+	return G_SOURCE_CONTINUE;
 }
 
-struct widget* wofi_create_widget(struct mode* mode, char* text[], char* search_text, char* actions[], size_t action_count) {
-	struct widget* widget = calloc(1, sizeof(struct widget));
-	widget->mode = strdup(mode->name);
-	widget->text = malloc(action_count * sizeof(char*));
-	for(size_t count = 0; count < action_count; ++count) {
-		widget->text[count] = strdup(text[count]);
+static gboolean _set_loading(gpointer data) {
+	if(GPOINTER_TO_INT(data)) {
+		++loading_modes;
+	} else if(loading_modes > 0) {
+		--loading_modes;
 	}
-	widget->search_text = strdup(search_text);
-	widget->action_count = action_count;
-	widget->actions = malloc(action_count * sizeof(char*));
-	for(size_t count = 0; count < action_count; ++count) {
-		widget->actions[count] = strdup(actions[count]);
+	if(entry == NULL) {
+		return G_SOURCE_REMOVE;
 	}
-	return widget;
+
+	GtkStyleContext* style = gtk_widget_get_style_context(window);
+	if(loading_modes > 0 && loading_source == 0) {
+		gtk_style_context_add_class(style, "loading");
+		loading_source = g_timeout_add(100, pulse_loading, NULL);
+	} else if(loading_modes == 0 && loading_source != 0) {
+		gtk_style_context_remove_class(style, "loading");
+		g_source_remove(loading_source);
+		loading_source = 0;
+		gtk_entry_set_progress_fraction(GTK_ENTRY(entry), 0);
+	}
+	return G_SOURCE_REMOVE;
 }
 
-void wofi_insert_widgets(struct mode* mode) {
-	gdk_threads_add_idle(_insert_widget, mode);
+void wofi_set_loading(struct mode* mode, bool loading) {
+	(void) mode;
+	gdk_threads_add_idle(_set_loading, GINT_TO_POINTER(loading));
 }
 
 char* wofi_get_dso_path(struct mode* mode) {
@@ -1055,7 +1152,12 @@ uint64_t wofi_get_image_size(void) {
 }
 
 uint64_t wofi_get_window_scale(void) {
-	return gdk_window_get_scale_factor(gtk_widget_get_window(window));
+	static uint64_t scale = 1;
+	//A hidden daemon's window isn't realized, entries added meanwhile use the scale it was last shown at
+	if(window != NULL && gtk_widget_get_window(window) != NULL) {
+		scale = gdk_window_get_scale_factor(gtk_widget_get_window(window));
+	}
+	return scale;
 }
 
 bool wofi_mod_shift(void) {
@@ -1116,7 +1218,7 @@ static void activate_search(GtkEntry* entry, gpointer data) {
 		if(primary_action) {
 			box = gtk_expander_get_label_widget(GTK_EXPANDER(box));
 		}
-		execute_action(wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "mode"), wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "action"));
+		execute_action(g_object_get_data(G_OBJECT(box), "mode"), wofi_property_box_get_property(WOFI_PROPERTY_BOX(box), "action"));
 	}
 }
 
@@ -1176,17 +1278,18 @@ static gint do_sort(GtkFlowBoxChild* child1, GtkFlowBoxChild* child2, gpointer d
 
 	const gchar* text1 = wofi_property_box_get_property(WOFI_PROPERTY_BOX(box1), "filter");
 	const gchar* text2 = wofi_property_box_get_property(WOFI_PROPERTY_BOX(box2), "filter");
-	uint64_t index1 = strtol(wofi_property_box_get_property(WOFI_PROPERTY_BOX(box1), "index"), NULL, 10);
-	uint64_t index2 = strtol(wofi_property_box_get_property(WOFI_PROPERTY_BOX(box2), "index"), NULL, 10);
+	guint index1 = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(box1), "index"));
+	guint index2 = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(box2), "index"));
+	int by_index = index1 < index2 ? -1 : index1 > index2;
 
 	if(text1 == NULL || text2 == NULL) {
-		return index1 - index2;
+		return by_index;
 	}
 
 	int fallback = 0;
 	switch(sort_order) {
 	case SORT_ORDER_DEFAULT:
-		fallback = index1 - index2;
+		fallback = by_index;
 		break;
 	case SORT_ORDER_ALPHABETICAL:
 		if(insensitive) {
@@ -1318,6 +1421,11 @@ static void move_pgdn(void) {
 }
 
 static void do_exit(void) {
+	if(wofi_daemon_has_client()) {
+		wofi_daemon_reply_exit(1);
+		wofi_hide();
+		return;
+	}
 	wofi_exit(1);
 }
 
@@ -1343,7 +1451,7 @@ static void do_copy(void) {
 		GtkWidget* widget = gtk_bin_get_child(children->data);
 		if(GTK_IS_EXPANDER(widget)) {
 			GtkWidget* box = gtk_bin_get_child(GTK_BIN(widget));
-			GtkListBoxRow* row = gtk_list_box_get_selected_row(GTK_LIST_BOX(box));
+			GtkListBoxRow* row = box == NULL ? NULL : gtk_list_box_get_selected_row(GTK_LIST_BOX(box));
 			if(row == NULL) {
 				widget = gtk_expander_get_label_widget(GTK_EXPANDER(widget));
 			} else {
@@ -1390,6 +1498,13 @@ static void on_exit_set_custom_key_return_code(void) {
 void wofi_exit(int status) {
 	fflush(stdout);
 	fflush(stderr);
+	//Committing can wait on a detached cache write, whatever reads the selection shouldn't wait for EOF with it
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if(null_fd != -1) {
+		dup2(null_fd, STDOUT_FILENO);
+		close(null_fd);
+	}
+	cache_commit_all();
 
 	if(status == EXIT_SUCCESS) {
 		_exit(custom_key_return_code);
@@ -1398,6 +1513,37 @@ void wofi_exit(int status) {
 	_exit(status);
 }
 
+void wofi_show(void) {
+	if(shell != NULL && wlr_surface == NULL) {
+		gtk_widget_realize(window);
+		create_layer_surface();
+	}
+	gtk_widget_show(window);
+	gtk_widget_grab_focus(entry);
+}
+
+void wofi_hide(void) {
+	//The layer surface has to go before GDK is done with the wl_surface, it's recreated on the next show
+	if(wlr_surface != NULL) {
+		zwlr_layer_surface_v1_destroy(wlr_surface);
+		wlr_surface = NULL;
+	}
+	gtk_widget_hide(window);
+	//Hiding destroys the wl_surface and showing would make one GDK commits before it has a role, a fresh realize gets one up front
+	if(shell != NULL) {
+		gtk_widget_unrealize(window);
+	}
+
+	mod_shift = false;
+	mod_ctrl = false;
+	custom_key_return_code = EXIT_SUCCESS;
+	gtk_entry_set_text(GTK_ENTRY(entry), "");
+	GtkFlowBoxChild* child = gtk_flow_box_get_child_at_index(GTK_FLOW_BOX(inner_box), 0);
+	if(child != NULL) {
+		gtk_flow_box_select_child(GTK_FLOW_BOX(inner_box), child);
+	}
+}
+
 static void do_custom_key(int custom_key_num) {
 	custom_key_return_code = custom_key_num + 10;
 }
@@ -1548,7 +1694,7 @@ static gboolean key_press(GtkWidget* widget, GdkEvent* event, gpointer data) {
 				GtkWidget* exp = gtk_bin_get_child(GTK_BIN(obj));
 				if(GTK_IS_EXPANDER(exp)) {
 					GtkWidget* box = gtk_bin_get_child(GTK_BIN(exp));
-					GtkListBoxRow* row = gtk_list_box_get_selected_row(GTK_LIST_BOX(box));
+					GtkListBoxRow* row = box == NULL ? NULL : gtk_list_box_get_selected_row(GTK_LIST_BOX(box));
 					if(row != NULL) {
 						obj = row;
 					}
@@ -1607,12 +1753,14 @@ static void* get_plugin_proc(const char* prefix, const char* suffix) {
 	return proc;
 }
 
-static void* load_mode(char* _mode, char* name, struct mode* mode_ptr, struct map* props) {
+static void* load_mode(char* _mode, char* name, struct mode* mode_ptr, struct map* props, bool exec) {
 	char* dso = strstr(_mode, ".so");
 
-	mode_ptr->name = strdup(name);
+	//Every widget points at this rather than having its own copy
+	mode_ptr->name = (char*) utils_intern(name);
 
 	void (*init)(struct mode* _mode, struct map* props);
+	void (*exec_init)(struct mode* _mode, struct map* props);
 	void (*load)(struct mode* _mode);
 	const char** (*get_arg_names)(void);
 	size_t (*get_arg_count)(void);
@@ -1620,6 +1768,7 @@ static void* load_mode(char* _mode, char* name, struct mode* mode_ptr, struct ma
 	if(dso == NULL) {
 		mode_ptr->dso = NULL;
 		init = get_plugin_proc(_mode, "_init");
+		exec_init = get_plugin_proc(_mode, "_exec_init");
 		load = get_plugin_proc(_mode, "_load");
 		get_arg_names = get_plugin_proc(_mode, "_get_arg_names");
 		get_arg_count = get_plugin_proc(_mode, "_get_arg_count");
@@ -1634,6 +1783,7 @@ static void* load_mode(char* _mode, char* name, struct mode* mode_ptr, struct ma
 		free(full_name);
 		free(plugins_dir);
 		init = dlsym(plugin, "init");
+		exec_init = dlsym(plugin, "exec_init");
 		load = dlsym(plugin, "load");
 		get_arg_names = dlsym(plugin, "get_arg_names");
 		get_arg_count = dlsym(plugin, "get_arg_count");
@@ -1663,16 +1813,20 @@ static void* load_mode(char* _mode, char* name, struct mode* mode_ptr, struct ma
 		map_put(props, arg, config_get(config, full_name, NULL));
 		free(full_name);
 	}
+
+	//Only exec is going to be called so the mode can skip loading its entries if it knows how
+	if(exec && init != NULL && exec_init != NULL) {
+		return exec_init;
+	}
 	return init;
 }
 
-static struct mode* add_mode(char* _mode) {
+static struct mode* add_mode(char* _mode, bool exec) {
 	struct mode* mode_ptr = calloc(1, sizeof(struct mode));
 	struct map* props = map_init();
-	void (*init)(struct mode* _mode, struct map* props) = load_mode(_mode, _mode, mode_ptr, props);
+	void (*init)(struct mode* _mode, struct map* props) = load_mode(_mode, _mode, mode_ptr, props, exec);
 
 	if(init == NULL) {
-		free(mode_ptr->name);
 		free(mode_ptr->dso);
 		free(mode_ptr);
 		map_free(props);
@@ -1681,11 +1835,10 @@ static struct mode* add_mode(char* _mode) {
 		props = map_init();
 
 		char* name = utils_concat(3, "lib", _mode, ".so");
-		init = load_mode(name, _mode, mode_ptr, props);
+		init = load_mode(name, _mode, mode_ptr, props, exec);
 		free(name);
 
 		if(init == NULL) {
-			free(mode_ptr->name);
 			free(mode_ptr->dso);
 			free(mode_ptr);
 			map_free(props);
@@ -1693,7 +1846,7 @@ static struct mode* add_mode(char* _mode) {
 			mode_ptr = calloc(1, sizeof(struct mode));
 			props = map_init();
 
-			init = load_mode("external", _mode, mode_ptr, props);
+			init = load_mode("external", _mode, mode_ptr, props, exec);
 
 			map_put(props, "exec", _mode);
 
@@ -1716,16 +1869,49 @@ static void* start_mode_thread(void* data) {
 		char* save_ptr;
 		char* str = strtok_r(mode, ",", &save_ptr);
 		do {
-			struct mode* mode_ptr = add_mode(str);
+			struct mode* mode_ptr = add_mode(str, false);
 			wl_list_insert(&mode_list, &mode_ptr->link);
 		} while((str = strtok_r(NULL, ",", &save_ptr)) != NULL);
 	} else {
-		struct mode* mode_ptr = add_mode(mode);
+		struct mode* mode_ptr = add_mode(mode, false);
 		wl_list_insert(&mode_list, &mode_ptr->link);
 	}
+	free(mode);
+
+	//Stale entries dropped while the modes were loading are written out together
+	cache_commit_all();
 	return NULL;
 }
 
+//The daemon already resolved the selection, only its mode is loaded and only if it's one this client was started with
+static void load_exec_mode(const char* name) {
+	char* mode = strdup(map_get(config, "mode"));
+	char* save_ptr;
+	for(char* str = strtok_r(mode, ",", &save_ptr); str != NULL; str = strtok_r(NULL, ",", &save_ptr)) {
+		if(strcmp(str, name) == 0) {
+			add_mode(str, true);
+			break;
+		}
+	}
+	free(mode);
+}
+
+void wofi_exec(const char* mode, const char* cmd, bool shift, bool ctrl, int code) {
+	if(exec_only) {
+		load_exec_mode(mode);
+	} else if(!has_joined_mode) {
+		pthread_join(mode_thread, NULL);
+		has_joined_mode = true;
+	}
+	mod_shift = shift;
+	mod_ctrl = ctrl;
+	custom_key_return_code = code;
+	execute_action(mode, cmd);
+
+	//Nothing else is left for this process to do if the mode returns without exiting
+	wofi_exit(0);
+}
+
 static void add_key_entry(char* key, void (*action)(void)) {
 	char* tmp = strdup(key);
 	char* save_ptr;
@@ -1800,13 +1986,29 @@ static gboolean do_percent_size(gpointer data) {
 	bool width_percent = strchr(geo_str[0], '%') != NULL;
 	bool height_percent = strchr(geo_str[1], '%') != NULL && lines == 0;
 
+	if(gtk_widget_get_window(window) == NULL) {
+		return G_SOURCE_REMOVE;
+	}
 	GdkMonitor* monitor = gdk_display_get_monitor_at_window(gdk_display_get_default(), gtk_widget_get_window(window));
+	if(monitor == NULL) {
+		return G_SOURCE_REMOVE;
+	}
+
+	//Follow whichever monitor the window is on so geometry changes are delivered to us
+	if(monitor != percent_monitor) {
+		if(percent_monitor != NULL) {
+			g_signal_handlers_disconnect_by_func(percent_monitor, do_percent_size, data);
+			g_object_unref(percent_monitor);
+		}
+		percent_monitor = g_object_ref(monitor);
+		g_signal_connect_swapped(monitor, "notify::geometry", G_CALLBACK(do_percent_size), data);
+	}
 
 	GdkRectangle rect;
 	gdk_monitor_get_geometry(monitor, &rect);
 
 	if(rect.width == resolution.width && rect.height == resolution.height) {
-		return G_SOURCE_CONTINUE;
+		return G_SOURCE_REMOVE;
 	}
 
 	resolution = rect;
@@ -1820,11 +2022,15 @@ static gboolean do_percent_size(gpointer data) {
 		height = (h_percent / 100.f) * rect.height;
 	}
 	update_surface_size();
-	return G_SOURCE_CONTINUE;
+	return G_SOURCE_REMOVE;
 }
 
 static gboolean do_percent_size_first(gpointer data){
-	gdk_threads_add_timeout(50, do_percent_size, data);
+	GdkDisplay* display = gdk_display_get_default();
+	g_signal_connect_swapped(display, "monitor-added", G_CALLBACK(do_percent_size), data);
+	g_signal_connect_swapped(display, "monitor-removed", G_CALLBACK(do_percent_size), data);
+	//Also re-check whenever the window is resized, e.g. after the compositor configures the layer surface with a new size
+	g_signal_connect_swapped(window, "configure-event", G_CALLBACK(do_percent_size), data);
 	do_percent_size(data);
 	return G_SOURCE_REMOVE;
 }
@@ -1835,6 +2041,31 @@ static gboolean hide_search_first(gpointer data) {
 	return G_SOURCE_REMOVE;
 }
 
+static void read_mode_config(struct map* _config) {
+	config = _config;
+	allow_images = strcmp(config_get(config, "allow_images", "false"), "true") == 0;
+	allow_markup = strcmp(config_get(config, "allow_markup", "false"), "true") == 0;
+	image_size = strtol(config_get(config, "image_size", "32"), NULL, 10);
+	cache_file = map_get(config, "cache_file");
+	config_dir = map_get(config, "config_dir");
+	terminal = map_get(config, "term");
+
+	modes = map_init_void();
+	wl_list_init(&mode_list);
+}
+
+void wofi_start_modes(struct map* _config) {
+	read_mode_config(_config);
+
+	//The mode thread tokenizes its argument so it gets its own copy, the config value is still needed for the prompt
+	pthread_create(&mode_thread, NULL, start_mode_thread, strdup(map_get(config, "mode")));
+}
+
+void wofi_start_client(struct map* _config) {
+	read_mode_config(_config);
+	exec_only = true;
+}
+
 void wofi_init(struct map* _config) {
 	config = _config;
 	char* width_str = config_get(config, "width", "50%");
@@ -1861,13 +2092,7 @@ void wofi_init(struct map* _config) {
 	}
 	GtkAlign valign = config_get_mnemonic(config, "valign", default_valign, 4, "fill", "start", "end", "center");
 	char* prompt = config_get(config, "prompt", mode);
-	uint64_t filter_rate = strtol(config_get(config, "filter_rate", "100"), NULL, 10);
-	allow_images = strcmp(config_get(config, "allow_images", "false"), "true") == 0;
-	allow_markup = strcmp(config_get(config, "allow_markup", "false"), "true") == 0;
-	image_size = strtol(config_get(config, "image_size", "32"), NULL, 10);
-	cache_file = map_get(config, "cache_file");
-	config_dir = map_get(config, "config_dir");
-	terminal = map_get(config, "term");
+	filter_rate = strtol(config_get(config, "filter_rate", "100"), NULL, 10);
 	char* password_char = map_get(config, "password_char");
 	exec_search = strcmp(config_get(config, "exec_search", "false"), "true") == 0;
 	bool hide_scroll = strcmp(config_get(config, "hide_scroll", "false"), "true") == 0;
@@ -1887,6 +2112,7 @@ void wofi_init(struct map* _config) {
 	hide_search = strcmp(config_get(config, "hide_search", "false"), "true") == 0;
 	char* search = map_get(config, "search");
 	dynamic_lines = strcmp(config_get(config, "dynamic_lines", "false"), "true") == 0;
+	uniform_row_height = strcmp(config_get(config, "uniform_row_height", "false"), "true") == 0;
 	char* monitor = map_get(config, "monitor");
 	char* layer = config_get(config, "layer", "top");
 	copy_exec = config_get(config, "copy_exec", "wl-copy");
@@ -1998,8 +2224,6 @@ void wofi_init(struct map* _config) {
 		add_key_entry(keys_custom[19], CUSTOM_KEY_FUNC(19));
 	}
 
-	modes = map_init_void();
-
 	if(lines > 0) {
 		height = 1;
 	}
@@ -2071,12 +2295,9 @@ void wofi_init(struct map* _config) {
 			}
 		}
 
-		GdkWindow* gdk_win = gtk_widget_get_window(window);
+		wlr_output = output;
 
-		gdk_wayland_window_set_use_custom_surface(gdk_win);
-		wl_surface = gdk_wayland_window_get_wl_surface(gdk_win);
-
-		enum zwlr_layer_shell_v1_layer wlr_layer = ZWLR_LAYER_SHELL_V1_LAYER_TOP;
+		wlr_layer = ZWLR_LAYER_SHELL_V1_LAYER_TOP;
 
 		if(strcmp(layer, "background") == 0) {
 			wlr_layer = ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND;
@@ -2088,14 +2309,10 @@ void wofi_init(struct map* _config) {
 			wlr_layer = ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY;
 		}
 
-		wlr_surface = zwlr_layer_shell_v1_get_layer_surface(shell, wl_surface, output, wlr_layer, "wofi");
-		setup_surface(wlr_surface);
-		struct zwlr_layer_surface_v1_listener* surface_listener = malloc(sizeof(struct zwlr_layer_surface_v1_listener));
+		surface_listener = malloc(sizeof(struct zwlr_layer_surface_v1_listener));
 		surface_listener->configure = config_surface;
 		surface_listener->closed = nop;
-		zwlr_layer_surface_v1_add_listener(wlr_surface, surface_listener, NULL);
-		wl_surface_commit(wl_surface);
-		wl_display_roundtrip(wl);
+		create_layer_surface();
 	}
 
 	normal_win:
@@ -2182,6 +2399,7 @@ void wofi_init(struct map* _config) {
 	g_signal_connect(inner_box, "child-activated", G_CALLBACK(activate_item), NULL);
 	g_signal_connect(inner_box, "selected-children-changed", G_CALLBACK(select_item), NULL);
 	g_signal_connect(entry, "activate", G_CALLBACK(activate_search), NULL);
+	g_signal_connect(entry, "changed", G_CALLBACK(search_changed), NULL);
 	g_signal_connect(window, "key-press-event", G_CALLBACK(key_press), NULL);
 	g_signal_connect(window, "focus-in-event", G_CALLBACK(focus), NULL);
 	g_signal_connect(window, "focus-out-event", G_CALLBACK(focus), NULL);
@@ -2191,7 +2409,9 @@ void wofi_init(struct map* _config) {
 
 	dbus = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_NONE, NULL, "sm.puri.OSK0", "/sm/puri/OSK0", "sm.puri.OSK0", NULL, NULL);
 
-	gdk_threads_add_timeout(filter_rate, do_search, NULL);
+	if(search != NULL) {
+		search_changed(GTK_EDITABLE(entry), NULL);
+	}
 
 
 	bool width_percent = strchr(width_str, '%') != NULL;
@@ -2205,14 +2425,15 @@ void wofi_init(struct map* _config) {
 
 	gdk_threads_add_timeout(5, hide_search_first, NULL);
 
-	wl_list_init(&mode_list);
-
-	pthread_create(&mode_thread, NULL, start_mode_thread, mode);
-
 	gdk_threads_add_idle(insert_all_widgets, &mode_list);
 
 	gtk_window_set_title(GTK_WINDOW(window), prompt);
-	gtk_widget_show_all(window);
+	if(wofi_daemon_is_running()) {
+		//The daemon fills in the window while it's hidden and only shows it once a client connects
+		gtk_widget_show_all(outer_box);
+	} else {
+		gtk_widget_show_all(window);
+	}
 
 	atexit(on_exit_set_custom_key_return_code);
 }